@@ -0,0 +1,173 @@
+/*
+ * Allocation benchmarks for the mem_pool library.
+ *
+ * Run with MEM_POOL_SIMD=scalar or MEM_POOL_SIMD=sse2 to compare against the
+ * narrower gap search kernels.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "mem_pool.h"
+
+/* forward declarations */
+static double now_ns();
+static int cache_miss_counter();
+static long long read_counter(int fd);
+static void bench_gap_search(alloc_policy policy, unsigned num_gaps, unsigned rounds);
+static void bench_small_objects(alloc_policy policy, unsigned num_objects, unsigned rounds);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    assert(status == ALLOC_OK);
+
+    printf("%-10s %10s %14s\n", "policy", "gaps", "ns/alloc");
+
+    /*
+     * Gap search: the pool is num_gaps small gaps separated by allocations,
+     * followed by one big gap at the end. Every timed request is too big for
+     * the small gaps, so each search has to get past all of them.
+     */
+    bench_gap_search(FIRST_FIT, 10000, 2000);
+    bench_gap_search(FIRST_FIT, 100000, 200);
+    bench_gap_search(FIRST_FIT, 1000000, 20);
+    bench_gap_search(BEST_FIT, 10000, 2000);
+    bench_gap_search(BEST_FIT, 100000, 2000);
+    bench_gap_search(BEST_FIT, 1000000, 2000);
+
+    /*
+     * Small objects: a pool full of 16-64 byte allocations with random
+     * frees and re-allocations, where the node metadata is most of the
+     * memory touched. Cache misses are read from perf when the kernel
+     * exposes the counter.
+     */
+    printf("\n%-10s %10s %14s %14s\n", "policy", "objects", "ns/op", "misses/op");
+    bench_small_objects(FIRST_FIT, 100000, 100000);
+    bench_small_objects(BEST_FIT, 100000, 100000);
+
+    status = mem_free();
+    assert(status == ALLOC_OK);
+    (void) status;
+
+    return 0;
+}
+
+/* function definitions */
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cache_miss_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_counter(int fd) {
+    long long count = 0;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+static void bench_gap_search(alloc_policy policy, unsigned num_gaps, unsigned rounds) {
+    const size_t SMALL = 16;
+    const size_t BIG = 64;
+
+    pool_pt pool = mem_pool_open(num_gaps * 2 * SMALL + rounds * BIG, policy);
+    assert(pool);
+
+    alloc_pt *allocs = malloc(sizeof(alloc_pt) * num_gaps * 2);
+    assert(allocs);
+
+    // building the pool under FIRST_FIT would rescan everything on every
+    // allocation, and only the search is being measured, so set up as BEST_FIT
+    pool->policy = BEST_FIT;
+    for (unsigned u = 0; u < num_gaps * 2; u ++) {
+        allocs[u] = mem_new_alloc(pool, SMALL);
+        assert(allocs[u]);
+    }
+    for (unsigned u = 0; u < num_gaps * 2; u += 2) {
+        alloc_status status = mem_del_alloc(pool, allocs[u]);
+        assert(status == ALLOC_OK);
+        (void) status;
+    }
+    pool->policy = policy;
+
+    assert(pool->num_gaps == num_gaps + 1);
+
+    double start = now_ns();
+    for (unsigned u = 0; u < rounds; u ++) {
+        alloc_pt alloc = mem_new_alloc(pool, BIG);
+        assert(alloc);
+        (void) alloc;
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%-10s %10u %14.1f\n", policy == FIRST_FIT ? "FIRST_FIT" : "BEST_FIT",
+           num_gaps, elapsed / rounds);
+
+    free(allocs);
+
+    alloc_status status = mem_pool_close(pool);
+    assert(status == ALLOC_OK);
+    (void) status;
+}
+
+static void bench_small_objects(alloc_policy policy, unsigned num_objects, unsigned rounds) {
+    pool_pt pool = mem_pool_open(num_objects * 64 + 4096, policy);
+    assert(pool);
+
+    alloc_pt *allocs = malloc(sizeof(alloc_pt) * num_objects);
+    assert(allocs);
+
+    srand(1);
+    for (unsigned u = 0; u < num_objects; u ++) {
+        allocs[u] = mem_new_alloc(pool, 16 + rand() % 49);
+        assert(allocs[u]);
+    }
+
+    int fd = cache_miss_counter();
+    long long misses = read_counter(fd);
+    double start = now_ns();
+    for (unsigned u = 0; u < rounds; u ++) {
+        unsigned k = rand() % num_objects;
+        alloc_status status = mem_del_alloc(pool, allocs[k]);
+        assert(status == ALLOC_OK);
+        (void) status;
+        allocs[k] = mem_new_alloc(pool, 16 + rand() % 49);
+        assert(allocs[k]);
+    }
+    double elapsed = now_ns() - start;
+    misses = misses < 0 ? -1 : read_counter(fd) - misses;
+    if (fd >= 0)
+        close(fd);
+
+    printf("%-10s %10u %14.1f ", policy == FIRST_FIT ? "FIRST_FIT" : "BEST_FIT",
+           num_objects, elapsed / rounds);
+    if (misses < 0)
+        printf("%14s\n", "n/a");
+    else
+        printf("%14.2f\n", (double) misses / rounds);
+
+    free(allocs);
+
+    alloc_status status = mem_pool_close(pool);
+    assert(status == ALLOC_OK);
+    (void) status;
+}
@@ -0,0 +1,143 @@
+/*
+ * Container workloads on a mem_pool versus the default allocator.
+ *
+ * Each workload runs once on the default resource/allocator and once on a
+ * fresh BEST_FIT pool, through std::pmr and through mem::pool_allocator.
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mem_pool.h"
+#include "mem_pool_resource.hpp"
+
+/* constants */
+static const size_t POOL_SIZE = 64 << 20;
+static const int VECTOR_ELEMS = 1000000;
+static const int MAP_KEYS = 200000;
+static const int LIST_ELEMS = 200000;
+
+/* workloads */
+template <class Vector>
+static long vector_push(Vector &v) {
+    long sum = 0;
+    for (int i = 0; i < VECTOR_ELEMS; i ++)
+        v.push_back(i);
+    for (int x : v)
+        sum += x;
+    return sum;
+}
+
+template <class Map>
+static long map_churn(Map &m) {
+    for (int i = 0; i < MAP_KEYS; i ++)
+        m.emplace(i, i);
+    for (int i = 0; i < MAP_KEYS; i += 2)
+        m.erase(i);
+    for (int i = 0; i < MAP_KEYS; i += 2)
+        m.emplace(i + MAP_KEYS, i);
+    return (long) m.size();
+}
+
+template <class List>
+static long list_churn(List &l) {
+    for (int i = 0; i < LIST_ELEMS; i ++)
+        l.push_back(i);
+    for (int round = 0; round < 4; round ++) {
+        for (int i = 0; i < LIST_ELEMS / 2; i ++) {
+            l.pop_front();
+            l.push_back(i);
+        }
+    }
+    return (long) l.size();
+}
+
+/* timing */
+template <class F>
+static void run(const char *workload, const char *allocator, F f) {
+    auto start = std::chrono::steady_clock::now();
+    long result = f();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-14s %-16s %10.1f   (%ld)\n", workload, allocator, ms, result);
+}
+
+// a fresh pool for each run, closed after the containers in f() are gone
+template <class F>
+static long with_pool(F f) {
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert(pool);
+    long result = f(pool);
+    assert(pool->num_allocs == 0);
+    alloc_status status = mem_pool_close(pool);
+    assert(status == ALLOC_OK);
+    (void) status;
+    return result;
+}
+
+/* main */
+int main() {
+
+    alloc_status status = mem_init();
+    assert(status == ALLOC_OK);
+
+    std::printf("%-14s %-16s %10s\n", "workload", "allocator", "ms");
+
+    run("vector", "pmr default", [] {
+        std::pmr::vector<int> v(std::pmr::new_delete_resource());
+        return vector_push(v);
+    });
+    run("vector", "pmr pool", [] {
+        return with_pool([](pool_pt pool) {
+            mem::pool_resource res(pool);
+            std::pmr::vector<int> v(&res);
+            return vector_push(v);
+        });
+    });
+
+    run("unordered_map", "pmr default", [] {
+        std::pmr::unordered_map<int, int> m(std::pmr::new_delete_resource());
+        return map_churn(m);
+    });
+    run("unordered_map", "pmr pool", [] {
+        return with_pool([](pool_pt pool) {
+            mem::pool_resource res(pool);
+            std::pmr::unordered_map<int, int> m(&res);
+            return map_churn(m);
+        });
+    });
+    run("unordered_map", "std::allocator", [] {
+        std::unordered_map<int, int> m;
+        return map_churn(m);
+    });
+    run("unordered_map", "pool_allocator", [] {
+        return with_pool([](pool_pt pool) {
+            using alloc = mem::pool_allocator<std::pair<const int, int>>;
+            std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, alloc>
+                m(0, std::hash<int>(), std::equal_to<int>(), alloc(pool));
+            return map_churn(m);
+        });
+    });
+
+    run("list", "std::allocator", [] {
+        std::list<int> l;
+        return list_churn(l);
+    });
+    run("list", "pool_allocator", [] {
+        return with_pool([](pool_pt pool) {
+            std::list<int, mem::pool_allocator<int>> l{mem::pool_allocator<int>(pool)};
+            return list_churn(l);
+        });
+    });
+
+    status = mem_free();
+    assert(status == ALLOC_OK);
+    (void) status;
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * mem::size_class_cache (size_class_cache.hpp) versus the C API on small-object churn.
+ *
+ * A pool is filled with small objects, then objects are freed and
+ * re-allocated at random. "fixed" runs use one size known at compile
+ * time, "mixed" runs pick 16-64 bytes at run time.
+ */
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "mem_pool.h"
+#include "size_class_cache.hpp"
+
+/* constants */
+static const unsigned NUM_OBJECTS = 100000;
+static const unsigned ROUNDS = 1000000;
+static const size_t POOL_SIZE = 64 << 20;
+static const size_t FIXED_SIZE = 32;
+
+using cache_type = mem::size_class_cache<BEST_FIT, 16, 16, 32, 48, 64>;
+
+/* timing */
+static void report(const char *api, const char *sizes, std::chrono::steady_clock::time_point start) {
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-10s %-8s %10.1f\n", api, sizes, ns / ROUNDS);
+}
+
+static size_t mixed_size() {
+    return 16 + std::rand() % 49;
+}
+
+/* C API */
+static void bench_c(bool fixed) {
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert(pool);
+
+    std::vector<alloc_pt> allocs(NUM_OBJECTS);
+    std::srand(1);
+    for (unsigned u = 0; u < NUM_OBJECTS; u ++)
+        allocs[u] = mem_new_alloc(pool, fixed ? FIXED_SIZE : mixed_size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned u = 0; u < ROUNDS; u ++) {
+        unsigned k = std::rand() % NUM_OBJECTS;
+        mem_del_alloc(pool, allocs[k]);
+        allocs[k] = mem_new_alloc(pool, fixed ? FIXED_SIZE : mixed_size());
+        assert(allocs[k]);
+    }
+    report("C API", fixed ? "fixed" : "mixed", start);
+
+    for (alloc_pt alloc : allocs)
+        mem_del_alloc(pool, alloc);
+    alloc_status status = mem_pool_close(pool);
+    assert(status == ALLOC_OK);
+    (void) status;
+}
+
+/* cache, size known at compile time */
+static void bench_cache_fixed() {
+    cache_type cache(POOL_SIZE);
+
+    std::vector<void *> blocks(NUM_OBJECTS);
+    std::srand(1);
+    for (unsigned u = 0; u < NUM_OBJECTS; u ++)
+        blocks[u] = cache.allocate<FIXED_SIZE>();
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned u = 0; u < ROUNDS; u ++) {
+        unsigned k = std::rand() % NUM_OBJECTS;
+        cache.deallocate<FIXED_SIZE>(blocks[k]);
+        blocks[k] = cache.allocate<FIXED_SIZE>();
+    }
+    report("cache", "fixed", start);
+}
+
+/* cache, sizes picked at run time */
+static void bench_cache_mixed() {
+    cache_type cache(POOL_SIZE);
+
+    std::vector<void *> blocks(NUM_OBJECTS);
+    std::vector<size_t> sizes(NUM_OBJECTS);
+    std::srand(1);
+    for (unsigned u = 0; u < NUM_OBJECTS; u ++) {
+        sizes[u] = mixed_size();
+        blocks[u] = cache.allocate(sizes[u]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned u = 0; u < ROUNDS; u ++) {
+        unsigned k = std::rand() % NUM_OBJECTS;
+        cache.deallocate(blocks[k], sizes[k]);
+        sizes[k] = mixed_size();
+        blocks[k] = cache.allocate(sizes[k]);
+    }
+    report("cache", "mixed", start);
+}
+
+/* main */
+int main() {
+
+    alloc_status status = mem_init();
+    assert(status == ALLOC_OK);
+
+    std::printf("%-10s %-8s %10s\n", "api", "sizes", "ns/op");
+    bench_c(true);
+    bench_cache_fixed();
+    bench_c(false);
+    bench_cache_mixed();
+
+    status = mem_free();
+    assert(status == ALLOC_OK);
+    (void) status;
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+/*
+ * CHECK() for the check_*.c programs ctest runs. It is assert() that is
+ * never compiled out: the checks call the library inside it, and a
+ * Release build (NDEBUG) has to run and check them just the same.
+ */
+
+#ifndef DENVER_OS_PA_C_CHECK_H
+#define DENVER_OS_PA_C_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: Check `%s' failed.\n", __FILE__, __LINE__, __func__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+#endif //DENVER_OS_PA_C_CHECK_H
@@ -0,0 +1,229 @@
+/*
+ * Checks for ADAPTIVE pools: a free list long enough to make FIRST_FIT scan
+ * switches the pool to BEST_FIT, a steady run of one size switches it back,
+ * the switch log and the stats agree with each other and with the pool's
+ * allocation count, clones carry the placement over, compact pools adapt
+ * the same way, and a long random churn keeps the pool consistent under
+ * whichever placement is in use. FIRST_FIT and BEST_FIT pools never adapt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define POOL_SIZE       (1 << 20)
+#define NUM_SMALL       8000
+#define NUM_STEADY      100
+#define NUM_LIVE        5000
+#define NUM_OPS         200000
+
+/* forward declarations */
+static void check_fixed(alloc_policy policy);
+static void check_switches(int compact);
+static void check_log(pool_pt pool);
+static void check_churn();
+static void check_counters(pool_pt pool);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_fixed(FIRST_FIT);
+    check_fixed(BEST_FIT);
+    check_switches(0);
+    check_switches(1);
+    check_churn();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_adaptive OK\n");
+
+    return 0;
+}
+
+static void check_fixed(alloc_policy policy) {
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, policy);
+    CHECK(pool);
+
+    for (int i = 0; i < 1000; i++)
+        CHECK(mem_new_alloc(pool, 1 + i % 100));
+
+    adapt_stats_t stats;
+    adapt_switch_t switches[4];
+    mem_pool_adapt_stats(pool, &stats);
+    CHECK(stats.placement == policy && stats.windows == 0 && stats.switches == 0);
+    CHECK(mem_pool_adapt_switches(pool, switches, 4) == 0);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// every other small block freed leaves a long free list, then one size over and over
+static void check_switches(int compact) {
+
+    pool_pt pool = compact ? mem_pool_open_compact(POOL_SIZE, ADAPTIVE) : mem_pool_open(POOL_SIZE, ADAPTIVE);
+    CHECK(pool && pool->policy == ADAPTIVE);
+
+    adapt_stats_t stats;
+    mem_pool_adapt_stats(pool, &stats);
+    CHECK(stats.placement == FIRST_FIT && stats.windows == 0);
+
+    static alloc_pt small[NUM_SMALL];
+    for (int i = 0; i < NUM_SMALL; i++)
+        CHECK((small[i] = mem_new_alloc(pool, 16)));
+    for (int i = 0; i < NUM_SMALL; i += 2)
+        CHECK(mem_del_alloc(pool, small[i]) == ALLOC_OK);
+    static alloc_pt medium[1000];
+    for (int i = 0; i < 1000; i++)
+        CHECK((medium[i] = mem_new_alloc(pool, 32)));
+
+    mem_pool_adapt_stats(pool, &stats);
+    CHECK(stats.placement == BEST_FIT && stats.switches == 1);
+
+    adapt_switch_t switches[4];
+    CHECK(mem_pool_adapt_switches(pool, switches, 4) == 1);
+    CHECK(switches[0].from == FIRST_FIT && switches[0].to == BEST_FIT);
+    CHECK(switches[0].reason == ADAPT_LONG_SCANS);
+    CHECK(switches[0].window.scan_len > 100);
+
+    // a clone places the way the pool does now
+    if (!compact) {
+        pool_pt clone = mem_pool_clone(pool);
+        CHECK(clone);
+        adapt_stats_t clone_stats;
+        mem_pool_adapt_stats(clone, &clone_stats);
+        CHECK(clone_stats.placement == BEST_FIT && clone_stats.switches == 1);
+        CHECK(mem_pool_close(clone) == ALLOC_OK);
+    }
+
+    for (int i = 1; i < NUM_SMALL; i += 2)
+        CHECK(mem_del_alloc(pool, small[i]) == ALLOC_OK);
+    for (int i = 0; i < 1000; i++)
+        CHECK(mem_del_alloc(pool, medium[i]) == ALLOC_OK);
+
+    alloc_pt steady[NUM_STEADY];
+    for (int round = 0; round < 3000; round++) {
+        int k = round % NUM_STEADY;
+        if (round >= NUM_STEADY)
+            CHECK(mem_del_alloc(pool, steady[k]) == ALLOC_OK);
+        CHECK((steady[k] = mem_new_alloc(pool, 64)));
+    }
+
+    mem_pool_adapt_stats(pool, &stats);
+    CHECK(stats.placement == FIRST_FIT && stats.switches == 2);
+    CHECK(mem_pool_adapt_switches(pool, switches, 4) == 2);
+    CHECK(switches[1].reason == ADAPT_UNIFORM && switches[1].window.size_cv == 0);
+    check_log(pool);
+    check_counters(pool);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// the log hands back the most recent switches in order, each picking up where the last left off
+static void check_log(pool_pt pool) {
+
+    adapt_stats_t stats;
+    mem_pool_adapt_stats(pool, &stats);
+
+    adapt_switch_t switches[32];
+    unsigned num_switches = mem_pool_adapt_switches(pool, switches, 32);
+    CHECK(num_switches <= stats.switches && (num_switches > 0) == (stats.switches > 0));
+    CHECK(stats.windows > 0 && stats.last.allocs > 0);
+
+    for (unsigned i = 0; i < num_switches; i++) {
+        CHECK(switches[i].from != switches[i].to);
+        CHECK(switches[i].at <= mem_pool_mark(pool));
+        CHECK(i == 0 || (switches[i].from == switches[i - 1].to && switches[i].at > switches[i - 1].at));
+    }
+    CHECK(num_switches == 0 || switches[num_switches - 1].to == stats.placement);
+
+    // fewer than there are, the newest ones
+    if (num_switches > 1) {
+        adapt_switch_t newest;
+        CHECK(mem_pool_adapt_switches(pool, &newest, 1) == 1);
+        CHECK(newest.at == switches[num_switches - 1].at);
+    }
+}
+
+// mixed sizes, freed by record or by pointer, checked against the segments as it goes
+static void check_churn() {
+
+    static alloc_pt live[NUM_LIVE];
+    unsigned num_live = 0;
+    unsigned seed = 1;
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, ADAPTIVE);
+    CHECK(pool);
+
+    for (int i = 0; i < NUM_OPS; i++) {
+
+        if (num_live < NUM_LIVE && (rand_r(&seed) % 100 < 55 || num_live == 0)) {
+
+            size_t size = 1 + rand_r(&seed) % (rand_r(&seed) % 10 ? 64 : 4000);
+            alloc_pt alloc = mem_new_alloc(pool, size);
+            if (!alloc)
+                continue;
+            CHECK(alloc->size == size && alloc->mem + size <= pool->mem + POOL_SIZE);
+            memset(alloc->mem, (int) num_live, size);
+            live[num_live++] = alloc;
+
+        } else {
+
+            unsigned k = rand_r(&seed) % num_live;
+            if (rand_r(&seed) & 1)
+                CHECK(mem_free_ptr(live[k]->mem) == ALLOC_OK);
+            else
+                CHECK(mem_del_alloc(pool, live[k]) == ALLOC_OK);
+            live[k] = live[--num_live];
+        }
+
+        if (i % 997 == 0) {
+            check_counters(pool);
+            CHECK(pool->num_allocs == num_live);
+        }
+    }
+
+    adapt_stats_t stats;
+    mem_pool_adapt_stats(pool, &stats);
+    CHECK(stats.windows > NUM_OPS / 2 / 256 / 2);
+    check_log(pool);
+
+    while (num_live)
+        CHECK(mem_del_alloc(pool, live[--num_live]) == ALLOC_OK);
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// the counters against a walk of the segments, and no two gaps in a row
+static void check_counters(pool_pt pool) {
+
+    pool_segment_pt segments;
+    unsigned num_segments;
+    mem_inspect_pool(pool, &segments, &num_segments);
+    CHECK(segments);
+
+    unsigned num_gaps = 0, num_allocs = 0;
+    size_t total_size = 0, alloc_size = 0;
+    for (unsigned i = 0; i < num_segments; i++) {
+        total_size += segments[i].size;
+        if (segments[i].allocated) {
+            num_allocs++;
+            alloc_size += segments[i].size;
+        } else {
+            num_gaps++;
+            CHECK(i == 0 || segments[i - 1].allocated);
+        }
+    }
+
+    CHECK(total_size == pool->total_size && alloc_size == pool->alloc_size);
+    CHECK(num_gaps == pool->num_gaps && num_allocs == pool->num_allocs);
+
+    free(segments);
+}
@@ -0,0 +1,137 @@
+/*
+ * Checks for mem::size_class_cache (size_class_cache.hpp): blocks from
+ * compile-time and run-time sizes are aligned and never overlap, freed
+ * blocks are reused before the pool is asked for more, the pool only ever
+ * sees whole chunks, and large blocks go to the pool and come back.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+#include "mem_pool.h"
+#include "size_class_cache.hpp"
+#include "check.h"
+
+using cache_type = mem::size_class_cache<BEST_FIT, 16, 16, 32, 48, 64, 256>;
+
+/* forward declarations */
+static void check_known_sizes();
+static void check_run_time_sizes();
+static void check_large();
+
+/* main */
+int main() {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_known_sizes();
+    check_run_time_sizes();
+    check_large();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    std::printf("check_cache OK\n");
+
+    return 0;
+}
+
+static void check_known_sizes() {
+
+    cache_type cache(1 << 20);
+
+    // the first block carves a chunk, the rest of it comes off the free list
+    void *first = cache.allocate<24>();
+    CHECK(reinterpret_cast<std::uintptr_t>(first) % 16 == 0);
+    CHECK(cache.pool()->num_allocs == 1);
+
+    std::vector<void *> blocks;
+    for (int i = 0; i < 4096 / 32 - 1; i++)
+        blocks.push_back(cache.allocate<32>());
+    CHECK(cache.pool()->num_allocs == 1);
+
+    // a freed block is the next one handed out
+    cache.deallocate<24>(first);
+    CHECK(cache.allocate<17>() == first);
+
+    // one more than a chunk holds needs a second chunk
+    blocks.push_back(cache.allocate<32>());
+    CHECK(cache.pool()->num_allocs == 2);
+
+    // no two blocks overlap
+    blocks.push_back(first);
+    for (std::size_t i = 0; i < blocks.size(); i++)
+        std::memset(blocks[i], (int) i, 32);
+    for (std::size_t i = 0; i < blocks.size(); i++)
+        for (int j = 0; j < 32; j++)
+            CHECK(static_cast<unsigned char *>(blocks[i])[j] == (unsigned char) i);
+
+    for (void *block : blocks)
+        cache.deallocate<32>(block);
+}
+
+// random sizes, checked block by block before they're freed
+static void check_run_time_sizes() {
+
+    cache_type cache(8 << 20);
+
+    const unsigned num_live = 5000;
+    std::vector<unsigned char *> live(num_live);
+    std::vector<std::size_t> sizes(num_live);
+    unsigned seed = 1;
+
+    for (unsigned i = 0; i < num_live; i++) {
+        sizes[i] = 1 + rand_r(&seed) % 256;
+        live[i] = static_cast<unsigned char *>(cache.allocate(sizes[i]));
+        CHECK(reinterpret_cast<std::uintptr_t>(live[i]) % 16 == 0);
+        std::memset(live[i], (int) (i & 0xFF), sizes[i]);
+    }
+
+    for (int round = 0; round < 100000; round++) {
+        unsigned k = rand_r(&seed) % num_live;
+        for (std::size_t j = 0; j < sizes[k]; j++)
+            CHECK(live[k][j] == (unsigned char) (k & 0xFF));
+        cache.deallocate(live[k], sizes[k]);
+
+        sizes[k] = 1 + rand_r(&seed) % 256;
+        live[k] = static_cast<unsigned char *>(cache.allocate(sizes[k]));
+        CHECK(reinterpret_cast<std::uintptr_t>(live[k]) % 16 == 0);
+        std::memset(live[k], (int) (k & 0xFF), sizes[k]);
+    }
+
+    // only chunks are pool allocations, never the blocks in them
+    CHECK(cache.pool()->num_allocs < num_live / 10);
+
+    for (unsigned i = 0; i < num_live; i++)
+        cache.deallocate(live[i], sizes[i]);
+}
+
+// past the largest class it's a pool allocation of its own, freed right away
+static void check_large() {
+
+    cache_type cache(1 << 20);
+    pool_pt pool = cache.pool();
+
+    void *big = cache.allocate<1000>();
+    void *odd = cache.allocate(257);
+    CHECK(pool->num_allocs == 2);
+    CHECK(mem_find_alloc(big) && mem_find_alloc(big)->size == 1008);
+    CHECK(mem_find_alloc(odd) && mem_find_alloc(odd)->size == 272);
+
+    cache.deallocate<1000>(big);
+    cache.deallocate(odd, 257);
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+
+    // a full pool throws
+    bool thrown = false;
+    try {
+        cache.deallocate(cache.allocate(2 << 20), 2 << 20);
+    } catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
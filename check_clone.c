@@ -0,0 +1,139 @@
+/*
+ * Checks for mem_pool_clone(), from plain and copy-on-write pools: a clone
+ * starts with the pool's data and allocations, the two diverge from there
+ * in both directions, later clones see what the pool did since, clones can
+ * be cloned, zeroed allocations stay zero in all of them, and compact pools
+ * are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define POOL_SIZE       (8 << 20)
+#define NUM_ALLOCS      64
+#define ALLOC_SIZE      50000
+
+/* forward declarations */
+static void check_clone(pool_pt pool);
+static void check_compact();
+static char *same_place(pool_pt from, pool_pt to, const char *mem);
+static int all_zero(const char *mem, size_t size);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    CHECK(pool);
+    check_clone(pool);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    pool = mem_pool_open_cow(POOL_SIZE, FIRST_FIT);
+    CHECK(pool);
+    check_clone(pool);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    check_compact();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_clone OK\n");
+
+    return 0;
+}
+
+static void check_clone(pool_pt pool) {
+
+    alloc_pt allocs[NUM_ALLOCS];
+    for (int i = 0; i < NUM_ALLOCS; i++) {
+        allocs[i] = mem_new_alloc(pool, ALLOC_SIZE);
+        CHECK(allocs[i]);
+        memset(allocs[i]->mem, i + 1, ALLOC_SIZE);
+    }
+
+    pool_pt first = mem_pool_clone(pool);
+    CHECK(first);
+    CHECK(first->mem != pool->mem && mem_pool_owner(first->mem) == first);
+    CHECK(first->num_allocs == pool->num_allocs && first->alloc_size == pool->alloc_size);
+    CHECK(first->policy == pool->policy);
+
+    // the same allocations, at the same offsets, with the same data
+    for (int i = 0; i < NUM_ALLOCS; i++) {
+        alloc_pt alloc = mem_find_alloc(same_place(pool, first, allocs[i]->mem));
+        CHECK(alloc && alloc->size == allocs[i]->size);
+        CHECK(alloc->mem[0] == i + 1 && alloc->mem[ALLOC_SIZE - 1] == i + 1);
+    }
+
+    // writes and frees on either side stay there
+    alloc_pt mine = mem_find_alloc(same_place(pool, first, allocs[3]->mem));
+    memset(allocs[3]->mem, 0x77, ALLOC_SIZE);
+    memset(mine->mem, 0x55, ALLOC_SIZE);
+    CHECK(allocs[3]->mem[100] == 0x77 && mine->mem[100] == 0x55);
+
+    CHECK(mem_del_alloc(first, mem_find_alloc(same_place(pool, first, allocs[5]->mem))) == ALLOC_OK);
+    CHECK(first->num_allocs == NUM_ALLOCS - 1 && pool->num_allocs == NUM_ALLOCS);
+    CHECK(allocs[5]->mem[0] == 6);
+
+    char *freed = same_place(pool, first, allocs[4]->mem);
+    CHECK(mem_del_alloc(pool, allocs[4]) == ALLOC_OK);
+    alloc_pt later = mem_new_alloc(pool, 7000);
+    CHECK(later);
+    memset(later->mem, 0x66, 7000);
+    CHECK(mem_find_alloc(freed) && freed[0] == 5);
+
+    // a second clone sees all of that, a clone of the clone sees the clone
+    pool_pt second = mem_pool_clone(pool);
+    pool_pt third = mem_pool_clone(first);
+    CHECK(second && third);
+    CHECK(same_place(pool, second, allocs[3]->mem)[ALLOC_SIZE - 1] == 0x77);
+    CHECK(same_place(pool, second, later->mem)[6999] == 0x66);
+    CHECK(same_place(pool, second, allocs[20]->mem)[0] == 21);
+    CHECK(same_place(pool, third, allocs[3]->mem)[0] == 0x55);
+    CHECK(third->num_allocs == NUM_ALLOCS - 1);
+
+    // zeroed allocations over freed data, in each clone and then the pool
+    pool_pt all[] = { first, second, third, pool };
+    for (int i = 0; i < 4; i++) {
+        for (int j = 30; j < 40; j++) {
+            alloc_pt alloc = mem_find_alloc(same_place(pool, all[i], allocs[j]->mem));
+            CHECK(alloc && mem_del_alloc(all[i], alloc) == ALLOC_OK);
+        }
+        alloc_pt zero = mem_new_alloc_zeroed(all[i], 10 * ALLOC_SIZE);
+        CHECK(zero && all_zero(zero->mem, 10 * ALLOC_SIZE));
+    }
+
+    CHECK(mem_pool_close(third) == ALLOC_OK);
+    CHECK(mem_pool_close(second) == ALLOC_OK);
+    CHECK(mem_pool_close(first) == ALLOC_OK);
+
+    // the pool is untouched by closing its clones
+    CHECK(allocs[20]->mem[ALLOC_SIZE - 1] == 21);
+}
+
+static void check_compact() {
+
+    pool_pt pool = mem_pool_open_compact(1000, FIRST_FIT);
+    CHECK(pool);
+    CHECK(mem_pool_clone(pool) == NULL);
+    CHECK(mem_last_error() == MEM_ERR_UNSUPPORTED);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// where mem in one pool is in the other
+static char *same_place(pool_pt from, pool_pt to, const char *mem) {
+    return to->mem + (mem - from->mem);
+}
+
+static int all_zero(const char *mem, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        if (mem[i])
+            return 0;
+    return 1;
+}
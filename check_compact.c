@@ -0,0 +1,147 @@
+/*
+ * Checks for compact pools: many small ones open and close, each grows past
+ * the few nodes and tags its block starts with and keeps its counters right
+ * on the way, allocations come out aligned and zeroed when asked, and
+ * mem_free() closes whatever is left open.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define NUM_POOLS       10000
+#define POOL_SIZE       1000
+#define NUM_ALLOCS      40
+
+/* forward declarations */
+static void check_many();
+static void check_growth(alloc_policy policy);
+static void check_counters(pool_pt pool);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_many();
+    check_growth(FIRST_FIT);
+    check_growth(BEST_FIT);
+
+    CHECK(mem_pool_open_compact(0, FIRST_FIT) == NULL);
+    CHECK(mem_last_error() == MEM_ERR_BAD_SIZE);
+
+    // left open on purpose, mem_free() closes them (and the sanitizer build would catch a leak)
+    for (int i = 0; i < 100; i++) {
+        pool_pt pool = mem_pool_open_compact(POOL_SIZE, BEST_FIT);
+        CHECK(pool && mem_new_alloc(pool, 10));
+    }
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_compact OK\n");
+
+    return 0;
+}
+
+// a pool per small object, each with an allocation or two, closed in no particular order
+static void check_many() {
+
+    pool_pt *pools = malloc(sizeof(pool_pt) * NUM_POOLS);
+    CHECK(pools);
+
+    for (int i = 0; i < NUM_POOLS; i++) {
+        pools[i] = mem_pool_open_compact(64 + i % 200, i % 2 ? FIRST_FIT : BEST_FIT);
+        CHECK(pools[i]);
+        CHECK(pools[i]->total_size == (size_t) (64 + i % 200) && pools[i]->num_gaps == 1);
+
+        alloc_pt alloc = mem_new_alloc(pools[i], 32);
+        CHECK(alloc && (uintptr_t) alloc->mem % 16 == 0);
+        memset(alloc->mem, i & 0xFF, 32);
+    }
+
+    for (int i = 0; i < NUM_POOLS; i += 3)
+        CHECK(mem_pool_close(pools[i]) == ALLOC_OK);
+
+    // the rest are still whole
+    for (int i = 0; i < NUM_POOLS; i++) {
+        if (i % 3 == 0)
+            continue;
+        CHECK(pools[i]->num_allocs == 1 && pools[i]->mem[31] == (char) (i & 0xFF));
+        CHECK(mem_pool_close(pools[i]) == ALLOC_OK);
+    }
+
+    free(pools);
+}
+
+// more allocations and tags than fit in the block, freed and made again
+static void check_growth(alloc_policy policy) {
+
+    pool_pt pool = mem_pool_open_compact(POOL_SIZE * 10, policy);
+    CHECK(pool);
+
+    alloc_pt allocs[NUM_ALLOCS];
+    for (int i = 0; i < NUM_ALLOCS; i++) {
+        allocs[i] = mem_new_alloc_tagged(pool, 8 + i, i);
+        CHECK(allocs[i]);
+        memset(allocs[i]->mem, i + 1, 8 + i);
+    }
+    CHECK(pool->num_allocs == NUM_ALLOCS);
+    check_counters(pool);
+
+    tag_stats_t stats[NUM_ALLOCS];
+    CHECK(mem_pool_top_tags(pool, stats, NUM_ALLOCS) == NUM_ALLOCS);
+    CHECK(stats[0].tag == NUM_ALLOCS - 1 && stats[0].live_bytes == 8 + NUM_ALLOCS - 1);
+
+    for (int i = 0; i < NUM_ALLOCS; i += 2)
+        CHECK(mem_del_alloc(pool, allocs[i]) == ALLOC_OK);
+    check_counters(pool);
+
+    // the old data survived the growth, and freed space comes back zeroed when asked
+    for (int i = 1; i < NUM_ALLOCS; i += 2)
+        CHECK(allocs[i]->mem[0] == i + 1 && allocs[i]->mem[7 + i] == i + 1);
+    for (int i = 0; i < NUM_ALLOCS; i += 2) {
+        allocs[i] = mem_new_alloc_zeroed(pool, 8);
+        CHECK(allocs[i]);
+        for (int j = 0; j < 8; j++)
+            CHECK(allocs[i]->mem[j] == 0);
+    }
+    check_counters(pool);
+
+    for (int i = 0; i < NUM_ALLOCS; i++)
+        CHECK(mem_del_alloc(pool, allocs[i]) == ALLOC_OK);
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1 && pool->alloc_size == 0);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// the counters against a walk of the segments
+static void check_counters(pool_pt pool) {
+
+    pool_segment_pt segments;
+    unsigned num_segments;
+    mem_inspect_pool(pool, &segments, &num_segments);
+    CHECK(segments);
+
+    unsigned num_gaps = 0, num_allocs = 0;
+    size_t total_size = 0, alloc_size = 0;
+    for (unsigned i = 0; i < num_segments; i++) {
+        total_size += segments[i].size;
+        if (segments[i].allocated) {
+            num_allocs++;
+            alloc_size += segments[i].size;
+        } else {
+            num_gaps++;
+        }
+    }
+
+    CHECK(total_size == pool->total_size && alloc_size == pool->alloc_size);
+    CHECK(num_gaps == pool->num_gaps && num_allocs == pool->num_allocs);
+
+    free(segments);
+}
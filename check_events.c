@@ -0,0 +1,218 @@
+/*
+ * Checks for the failure event ring: every failure is recorded with its
+ * error, pool and size and a message naming the function, sequence numbers
+ * run on without gaps until the ring overflows, an overflow drops the
+ * oldest events, readers draining alongside writers on several threads
+ * never see an event twice or out of order, and mem_dump_events() writes
+ * one parsable line per event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define NUM_THREADS     4
+#define NUM_FAILURES    20000
+#define MAX_EVENTS      16
+
+static int num_done;    // writer threads that have finished
+
+/* forward declarations */
+static void check_recorded();
+static void check_overflow();
+static void check_threads();
+static void check_dump();
+static void *fail(void *arg);
+static void drain_all();
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_recorded();
+    check_overflow();
+    check_threads();
+    check_dump();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_events OK\n");
+
+    return 0;
+}
+
+static void check_recorded() {
+
+    drain_all();
+
+    mem_event_t events[MAX_EVENTS];
+    CHECK(mem_drain_events(events, MAX_EVENTS) == 0);
+
+    CHECK(mem_init() == ALLOC_NOT_FREED);
+
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    CHECK(pool);
+    CHECK(mem_new_alloc(pool, 2000) == NULL);
+    alloc_pt alloc = mem_new_alloc(pool, 1000);
+    CHECK(alloc);
+    CHECK(mem_new_alloc(pool, 10) == NULL);
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+    CHECK(mem_new_alloc(pool, 600));
+    CHECK(mem_new_alloc(pool, 500) == NULL);
+    CHECK(mem_free_ptr(pool) == ALLOC_FAIL);
+
+    struct {
+        mem_error error;
+        const char *function;
+        pool_pt pool;
+        size_t size;
+    } expected[] = {
+        { MEM_ERR_CALLED_AGAIN, "mem_init(): ", NULL, 0 },
+        { MEM_ERR_BAD_SIZE, "mem_new_alloc(): ", pool, 2000 },
+        { MEM_ERR_FULL, "mem_new_alloc(): ", pool, 10 },
+        { MEM_ERR_NO_FIT, "mem_new_alloc(): ", pool, 500 },
+        { MEM_ERR_NOT_FOUND, "mem_free_ptr(): ", NULL, 0 },
+    };
+    unsigned num_expected = sizeof(expected) / sizeof(expected[0]);
+
+    CHECK(mem_drain_events(events, MAX_EVENTS) == num_expected);
+    for (unsigned i = 0; i < num_expected; i++) {
+        CHECK(events[i].error == expected[i].error);
+        CHECK(strncmp(events[i].what, expected[i].function, strlen(expected[i].function)) == 0);
+        CHECK(strlen(events[i].what) > strlen(expected[i].function));
+        CHECK(events[i].pool == expected[i].pool && events[i].size == expected[i].size);
+        CHECK(i == 0 || (events[i].seq == events[i - 1].seq + 1 && events[i].time >= events[i - 1].time));
+    }
+    CHECK(mem_error_str(events[0].error) && *mem_error_str(events[0].error));
+
+    // drained is gone
+    CHECK(mem_drain_events(events, MAX_EVENTS) == 0);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// far more failures than the ring holds, with nobody draining
+static void check_overflow() {
+
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    CHECK(pool);
+
+    for (size_t size = 1; size <= NUM_FAILURES; size++)
+        CHECK(mem_new_alloc(pool, 1000 + size) == NULL);
+
+    // only the newest are left, still consecutive, and the very last one is there
+    mem_event_t events[MAX_EVENTS];
+    unsigned num_events, total = 0;
+    size_t last_size = 0;
+    unsigned long last_seq = 0;
+
+    while ((num_events = mem_drain_events(events, MAX_EVENTS))) {
+        for (unsigned i = 0; i < num_events; i++) {
+            CHECK(events[i].error == MEM_ERR_BAD_SIZE);
+            CHECK(total == 0 || (events[i].seq == last_seq + 1 && events[i].size == last_size + 1));
+            last_seq = events[i].seq;
+            last_size = events[i].size;
+            total++;
+        }
+    }
+
+    CHECK(total > 0 && total < NUM_FAILURES);
+    CHECK(last_size == 1000 + NUM_FAILURES);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// writers on several threads, one reader draining while they go
+static void check_threads() {
+
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    CHECK(pool);
+
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++)
+        CHECK(pthread_create(&threads[i], NULL, fail, pool) == 0);
+
+    mem_event_t events[MAX_EVENTS];
+    unsigned long total = 0, next_seq = 0;
+    int running = 1;
+
+    while (running) {
+
+        // one last drain after they're all done
+        running = __atomic_load_n(&num_done, __ATOMIC_ACQUIRE) < NUM_THREADS;
+
+        unsigned num_events;
+        while ((num_events = mem_drain_events(events, MAX_EVENTS))) {
+            for (unsigned i = 0; i < num_events; i++) {
+                CHECK(events[i].error == MEM_ERR_BAD_SIZE && events[i].pool == pool);
+                CHECK(total == 0 || events[i].seq >= next_seq);
+                next_seq = events[i].seq + 1;
+                total++;
+            }
+        }
+    }
+
+    for (int i = 0; i < NUM_THREADS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+
+    CHECK(total > 0 && total <= NUM_THREADS * NUM_FAILURES);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+static void check_dump() {
+
+    drain_all();
+
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    CHECK(pool);
+    CHECK(mem_new_alloc(pool, 2000) == NULL);
+    CHECK(mem_new_alloc(pool, 3000) == NULL);
+
+    FILE *out = tmpfile();
+    CHECK(out);
+    mem_dump_events(out);
+    rewind(out);
+
+    char line[512];
+    size_t sizes[2];
+    int error;
+    for (int i = 0; i < 2; i++) {
+        CHECK(fgets(line, sizeof(line), out));
+        CHECK(sscanf(line, "mem_pool_event seq=%*u time=%*f error=%d pool=%*p size=%zu", &error, &sizes[i]) == 2);
+        CHECK(error == MEM_ERR_BAD_SIZE);
+        CHECK(strstr(line, "what=\"mem_new_alloc(): "));
+    }
+    CHECK(sizes[0] == 2000 && sizes[1] == 3000);
+    CHECK(fgets(line, sizeof(line), out) == NULL);
+    fclose(out);
+
+    // it drains, too
+    mem_event_t events[MAX_EVENTS];
+    CHECK(mem_drain_events(events, MAX_EVENTS) == 0);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+static void *fail(void *arg) {
+
+    pool_pt pool = arg;
+    for (int i = 0; i < NUM_FAILURES; i++)
+        CHECK(mem_new_alloc(pool, 0) == NULL);
+
+    __atomic_add_fetch(&num_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void drain_all() {
+
+    mem_event_t events[MAX_EVENTS];
+    while (mem_drain_events(events, MAX_EVENTS))
+        ;
+}
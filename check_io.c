@@ -0,0 +1,229 @@
+/*
+ * Checks for mem_pool_io: mem_pool_readv() reads straight into new blocks,
+ * short reads keep the blocks, end of file reads nothing, a bad descriptor
+ * or a full pool fails with nothing left allocated, more blocks than
+ * IOV_MAX still come back in order, mem_pool_gather() writes them out
+ * again, and where io_uring is built in, a fixed read lands in the pool's
+ * registered memory. Plain and compact pools alike.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#ifdef MEM_POOL_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "mem_pool.h"
+#include "mem_pool_io.h"
+#include "check.h"
+
+#define POOL_SIZE       (1 << 16)
+#define NUM_MANY        3000
+
+/* forward declarations */
+static void check_readv(pool_pt pool);
+static void check_many(pool_pt pool);
+static void check_ring(pool_pt pool);
+static void check_buffer_index();
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    for (int compact = 0; compact < 2; compact++) {
+
+        pool_pt pool = compact ? mem_pool_open_compact(POOL_SIZE, BEST_FIT) : mem_pool_open(POOL_SIZE, BEST_FIT);
+        CHECK(pool);
+
+        check_readv(pool);
+        check_many(pool);
+        check_ring(pool);
+
+        CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+        CHECK(mem_pool_close(pool) == ALLOC_OK);
+    }
+
+    check_buffer_index();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_io OK\n");
+
+    return 0;
+}
+
+static void check_readv(pool_pt pool) {
+
+    int in[2], out[2];
+    CHECK(pipe(in) == 0 && pipe(out) == 0);
+
+    // short of the blocks' total, the blocks are kept anyway
+    const char *msg = "hello, scatter gather world";
+    CHECK(write(in[1], msg, strlen(msg)) == (ssize_t) strlen(msg));
+
+    size_t sizes[] = { 5, 2, 100 };
+    alloc_pt blocks[3];
+    CHECK(mem_pool_readv(in[0], pool, sizes, 3, blocks) == (ssize_t) strlen(msg));
+    CHECK(pool->num_allocs == 3);
+    CHECK(blocks[0]->size == 5 && blocks[1]->size == 2 && blocks[2]->size == 100);
+    CHECK(memcmp(blocks[0]->mem, "hello", 5) == 0 && memcmp(blocks[1]->mem, ", ", 2) == 0);
+    CHECK(memcmp(blocks[2]->mem, "scatter gather world", 20) == 0);
+
+    // and out again, the first two of them
+    struct iovec iov[3];
+    CHECK(mem_pool_gather(blocks, 3, iov) == 3);
+    CHECK(iov[2].iov_base == blocks[2]->mem && iov[2].iov_len == 100);
+    CHECK(writev(out[1], iov, 2) == 7);
+    char buf[16] = { 0 };
+    CHECK(read(out[0], buf, sizeof(buf)) == 7 && strcmp(buf, "hello, ") == 0);
+
+    // end of file reads nothing but keeps the blocks
+    CHECK(close(in[1]) == 0);
+    size_t more[] = { 4, 4 };
+    alloc_pt eof[2];
+    CHECK(mem_pool_readv(in[0], pool, more, 2, eof) == 0);
+    CHECK(pool->num_allocs == 5);
+    CHECK(mem_del_alloc(pool, eof[0]) == ALLOC_OK && mem_del_alloc(pool, eof[1]) == ALLOC_OK);
+
+    // failures leave nothing allocated
+    errno = 0;
+    CHECK(mem_pool_readv(-1, pool, more, 2, eof) == -1 && errno == EBADF);
+    CHECK(eof[0] == NULL && eof[1] == NULL && pool->num_allocs == 3);
+
+    size_t too_big[] = { POOL_SIZE / 2, POOL_SIZE };
+    errno = 0;
+    CHECK(mem_pool_readv(in[0], pool, too_big, 2, eof) == -1 && errno == ENOMEM);
+    CHECK(pool->num_allocs == 3);
+
+    for (int i = 0; i < 3; i++)
+        CHECK(mem_del_alloc(pool, blocks[i]) == ALLOC_OK);
+
+    close(in[0]);
+    close(out[0]);
+    close(out[1]);
+}
+
+// more one-byte blocks than one readv() takes
+static void check_many(pool_pt pool) {
+
+    static size_t sizes[NUM_MANY];
+    static alloc_pt blocks[NUM_MANY];
+    char data[NUM_MANY];
+
+    CHECK(NUM_MANY > IOV_MAX);
+    for (int i = 0; i < NUM_MANY; i++) {
+        sizes[i] = 1;
+        data[i] = (char) i;
+    }
+
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], data, NUM_MANY) == NUM_MANY);
+
+    CHECK(mem_pool_readv(fds[0], pool, sizes, NUM_MANY, blocks) == NUM_MANY);
+    for (int i = 0; i < NUM_MANY; i++)
+        CHECK(blocks[i]->mem[0] == (char) i);
+
+    for (int i = 0; i < NUM_MANY; i++)
+        CHECK(mem_del_alloc(pool, blocks[i]) == ALLOC_OK);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+#ifdef MEM_POOL_IO_URING
+
+// one READ_FIXED from a pipe into a block, on a ring driven by hand
+static void check_ring(pool_pt pool) {
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring = (int) syscall(__NR_io_uring_setup, 4, &params);
+
+    // built in, but the kernel or a sandbox won't have it
+    if (ring < 0) {
+        printf("check_io: no io_uring here (errno %d), fixed buffers not checked\n", errno);
+        return;
+    }
+
+    CHECK(mem_pool_register_buffers(ring, pool) == 0);
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    char *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    struct io_uring_sqe *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    CHECK(sq != MAP_FAILED && cq != MAP_FAILED && sqes != MAP_FAILED);
+
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    CHECK(write(fds[1], "fixedbuf", 8) == 8);
+
+    alloc_pt block = mem_new_alloc_zeroed(pool, 100);
+    CHECK(block);
+
+    memset(&sqes[0], 0, sizeof(sqes[0]));
+    sqes[0].opcode = IORING_OP_READ_FIXED;
+    sqes[0].fd = fds[0];
+    sqes[0].addr = (unsigned long) block->mem;
+    sqes[0].len = 8;
+    sqes[0].buf_index = mem_pool_buffer_index(pool, block->mem);
+
+    unsigned *tail = (unsigned *) (sq + params.sq_off.tail);
+    unsigned mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ((unsigned *) (sq + params.sq_off.array))[*tail & mask] = 0;
+    __atomic_store_n(tail, *tail + 1, __ATOMIC_RELEASE);
+
+    CHECK(syscall(__NR_io_uring_enter, ring, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0) == 1);
+    struct io_uring_cqe *cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    CHECK(cqes[0].res == 8 && memcmp(block->mem, "fixedbuf", 8) == 0);
+
+    CHECK(mem_pool_unregister_buffers(ring) == 0);
+    CHECK(mem_del_alloc(pool, block) == ALLOC_OK);
+
+    munmap(sq, sq_size);
+    munmap(cq, cq_size);
+    munmap(sqes, sqes_size);
+    close(fds[0]);
+    close(fds[1]);
+    close(ring);
+}
+
+#else
+
+static void check_ring(pool_pt pool) {
+
+    errno = 0;
+    CHECK(mem_pool_register_buffers(-1, pool) == -1 && errno == ENOSYS);
+    errno = 0;
+    CHECK(mem_pool_unregister_buffers(-1) == -1 && errno == ENOSYS);
+}
+
+#endif
+
+// one index per MEM_POOL_IO_BUFFER_SIZE of the pool, the memory isn't touched
+static void check_buffer_index() {
+
+    pool_pt pool = mem_pool_open(MEM_POOL_IO_BUFFER_SIZE + (1 << 20), FIRST_FIT);
+    CHECK(pool);
+
+    CHECK(mem_pool_buffer_index(pool, pool->mem) == 0);
+    CHECK(mem_pool_buffer_index(pool, pool->mem + MEM_POOL_IO_BUFFER_SIZE - 1) == 0);
+    CHECK(mem_pool_buffer_index(pool, pool->mem + MEM_POOL_IO_BUFFER_SIZE) == 1);
+    CHECK(mem_pool_buffer_index(pool, pool->mem + pool->total_size - 1) == 1);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
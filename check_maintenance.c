@@ -0,0 +1,169 @@
+/*
+ * Checks for the maintenance worker: it starts and stops once, a pool left
+ * alone gives the pages of its big gaps back to the kernel, which then read
+ * as zero, and threads allocating while it grows things ahead of them leave
+ * the pool consistent.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define BIG_SIZE        (8 << 20)
+#define NUM_THREADS     4
+#define NUM_LIVE        1000
+#define NUM_OPS         50000
+
+/* forward declarations */
+static void check_start_stop();
+static void check_trim();
+static void check_growth();
+static void *churn(void *arg);
+static size_t resident_pages(const char *mem, size_t size);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_start_stop();
+    check_trim();
+    check_growth();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_maintenance OK\n");
+
+    return 0;
+}
+
+static void check_start_stop() {
+
+    pool_pt pool = mem_pool_open(4096, FIRST_FIT);
+    CHECK(pool);
+
+    CHECK(mem_pool_stop_maintenance(pool) == ALLOC_CALLED_AGAIN);
+    CHECK(mem_last_error() == MEM_ERR_CALLED_AGAIN);
+
+    CHECK(mem_pool_start_maintenance(pool) == ALLOC_OK);
+    CHECK(mem_pool_start_maintenance(pool) == ALLOC_CALLED_AGAIN);
+    CHECK(mem_last_error() == MEM_ERR_CALLED_AGAIN);
+    CHECK(mem_pool_stop_maintenance(pool) == ALLOC_OK);
+    CHECK(mem_pool_stop_maintenance(pool) == ALLOC_CALLED_AGAIN);
+
+    // again, and closed with the worker still running
+    CHECK(mem_pool_start_maintenance(pool) == ALLOC_OK);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// a big block touched and freed, then left alone for a few periods
+static void check_trim() {
+
+    pool_pt pool = mem_pool_open(BIG_SIZE, BEST_FIT);
+    CHECK(pool);
+    CHECK(mem_pool_start_maintenance(pool) == ALLOC_OK);
+
+    alloc_pt alloc = mem_new_alloc(pool, BIG_SIZE);
+    CHECK(alloc);
+    memset(alloc->mem, 0xAA, BIG_SIZE);
+    CHECK(resident_pages(pool->mem, BIG_SIZE) > 0);
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+
+    // the worker trims after a period with no calls, give it up to 5 s
+    for (int i = 0; i < 100 && resident_pages(pool->mem, BIG_SIZE) > 0; i++)
+        usleep(50000);
+    CHECK(resident_pages(pool->mem, BIG_SIZE) == 0);
+
+    // what comes back is zero, so a zeroed allocation over it is too
+    alloc = mem_new_alloc_zeroed(pool, BIG_SIZE);
+    CHECK(alloc);
+    for (size_t i = 0; i < BIG_SIZE; i++)
+        CHECK(alloc->mem[i] == 0);
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+
+    CHECK(mem_pool_stop_maintenance(pool) == ALLOC_OK);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// many small allocations from several threads, so the metadata keeps growing under the worker
+static void check_growth() {
+
+    pool_pt pool = mem_pool_open(16 << 20, FIRST_FIT);
+    CHECK(pool);
+    CHECK(mem_pool_start_maintenance(pool) == ALLOC_OK);
+
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++)
+        CHECK(pthread_create(&threads[i], NULL, churn, pool) == 0);
+    for (int i = 0; i < NUM_THREADS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+
+    CHECK(mem_pool_stop_maintenance(pool) == ALLOC_OK);
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1 && pool->alloc_size == 0);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+static void *churn(void *arg) {
+
+    pool_pt pool = arg;
+    alloc_pt live[NUM_LIVE];
+    unsigned seed = (unsigned) (uintptr_t) live;
+    unsigned num_live = 0;
+
+    for (int i = 0; i < NUM_OPS; i++) {
+
+        if (num_live < NUM_LIVE && (rand_r(&seed) % 100 < 60 || num_live == 0)) {
+
+            size_t size = 1 + rand_r(&seed) % 64;
+            alloc_pt alloc = mem_new_alloc(pool, size);
+            CHECK(alloc);
+            memset(alloc->mem, (int) num_live, size);
+            live[num_live++] = alloc;
+
+        } else {
+
+            unsigned k = rand_r(&seed) % num_live;
+            CHECK(live[k]->mem[0] == (char) k);
+            CHECK(mem_del_alloc(pool, live[k]) == ALLOC_OK);
+            live[k] = live[--num_live];
+            if (k < num_live)
+                live[k]->mem[0] = (char) k;
+        }
+    }
+
+    while (num_live)
+        CHECK(mem_del_alloc(pool, live[--num_live]) == ALLOC_OK);
+
+    return NULL;
+}
+
+// counts the whole pages in the range that are in memory
+static size_t resident_pages(const char *mem, size_t size) {
+
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) mem + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t) mem + size) & ~(page - 1);
+    size_t num_pages = (end - start) / page;
+
+    unsigned char *vec = malloc(num_pages);
+    CHECK(vec);
+    CHECK(mincore((void *) start, end - start, vec) == 0);
+
+    size_t resident = 0;
+    for (size_t i = 0; i < num_pages; i++)
+        resident += vec[i] & 1;
+
+    free(vec);
+    return resident;
+}
@@ -0,0 +1,166 @@
+/*
+ * Checks for the malloc() family from libmem_pool_malloc.so, which ctest
+ * preloads into this program: what each call promises (contents, zeroing,
+ * alignment, realloc() keeping the data), from several threads at once,
+ * and that the calls really went to the pools.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "check.h"
+
+#define NUM_THREADS     4
+#define NUM_LIVE        2000
+#define NUM_OPS         100000
+
+/* forward declarations */
+static void check_preloaded();
+static void check_calls();
+static void *churn(void *arg);
+static void fill(unsigned char *mem, size_t size, unsigned char seed);
+static int filled(const unsigned char *mem, size_t size, unsigned char seed);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    check_preloaded();
+    check_calls();
+
+    pthread_t threads[NUM_THREADS];
+    for (long i = 0; i < NUM_THREADS; i++)
+        CHECK(pthread_create(&threads[i], NULL, churn, (void *) (i + 1)) == 0);
+    for (int i = 0; i < NUM_THREADS; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+
+    printf("check_malloc OK\n");
+
+    return 0;
+}
+
+// malloc() is the library's, and it hands out the pool's 16-byte granules, which glibc doesn't
+static void check_preloaded() {
+
+    Dl_info info;
+    CHECK(dladdr((void *) malloc, &info) && info.dli_fname);
+    CHECK(strstr(info.dli_fname, "libmem_pool_malloc"));
+
+    void *ptr = malloc(1);
+    CHECK(ptr && malloc_usable_size(ptr) == 16);
+    free(ptr);
+}
+
+static void check_calls() {
+
+    free(NULL);
+
+    // calloc() is zero, even over what was just freed
+    unsigned char *dirty = malloc(1000);
+    CHECK(dirty);
+    memset(dirty, 0xAA, 1000);
+    free(dirty);
+    unsigned char *zero = calloc(250, 4);
+    CHECK(zero);
+    for (int i = 0; i < 1000; i++)
+        CHECK(zero[i] == 0);
+    free(zero);
+
+    // realloc() keeps the data, growing and shrinking
+    unsigned char *mem = malloc(100);
+    CHECK(mem);
+    fill(mem, 100, 1);
+    mem = realloc(mem, 100000);
+    CHECK(mem && filled(mem, 100, 1));
+    fill(mem, 100000, 2);
+    mem = realloc(mem, 10);
+    CHECK(mem && filled(mem, 10, 2));
+    CHECK(realloc(mem, 0) == NULL);
+
+    // every power-of-2 alignment, through all three calls
+    for (size_t alignment = sizeof(void *); alignment <= 8192; alignment *= 2) {
+        void *ptr = NULL;
+        CHECK(posix_memalign(&ptr, alignment, 100) == 0);
+        CHECK(ptr && (uintptr_t) ptr % alignment == 0);
+        CHECK(malloc_usable_size(ptr) >= 100);
+        fill(ptr, 100, 3);
+
+        void *aligned = aligned_alloc(alignment, alignment);
+        void *old = memalign(alignment, 1);
+        CHECK(aligned && (uintptr_t) aligned % alignment == 0);
+        CHECK(old && (uintptr_t) old % alignment == 0);
+
+        ptr = realloc(ptr, 5000);
+        CHECK(ptr && filled(ptr, 100, 3));
+
+        free(ptr);
+        free(aligned);
+        free(old);
+    }
+    void *ptr = NULL;
+    CHECK(posix_memalign(&ptr, 24, 100) != 0);
+
+    // big enough for a pool of its own
+    size_t big = 8 << 20;
+    mem = malloc(big);
+    CHECK(mem);
+    fill(mem, big, 4);
+    CHECK(filled(mem, big, 4));
+    free(mem);
+}
+
+// random sizes, small and big, each block checked before it's freed
+static void *churn(void *arg) {
+
+    static __thread unsigned char *live[NUM_LIVE];
+    static __thread size_t sizes[NUM_LIVE];
+    unsigned seed = (unsigned) (size_t) arg;
+    unsigned num_live = 0;
+
+    for (int i = 0; i < NUM_OPS; i++) {
+
+        if (num_live < NUM_LIVE && (rand_r(&seed) % 100 < 52 || num_live == 0)) {
+
+            size_t size = 1 + rand_r(&seed) % (rand_r(&seed) % 100 ? 512 : 2 << 20);
+            unsigned char *mem = rand_r(&seed) % 4 ? malloc(size) : calloc(1, size);
+            CHECK(mem);
+            fill(mem, size, (unsigned char) num_live);
+            live[num_live] = mem;
+            sizes[num_live++] = size;
+
+        } else {
+
+            unsigned k = rand_r(&seed) % num_live;
+            CHECK(filled(live[k], sizes[k], (unsigned char) k));
+            free(live[k]);
+            live[k] = live[--num_live];
+            sizes[k] = sizes[num_live];
+            if (k < num_live)
+                fill(live[k], sizes[k], (unsigned char) k);
+        }
+    }
+
+    while (num_live)
+        free(live[--num_live]);
+
+    return NULL;
+}
+
+// the first and last 64 bytes, enough to catch blocks that overlap
+static void fill(unsigned char *mem, size_t size, unsigned char seed) {
+    for (size_t i = 0; i < size; i = i == 63 && size > 128 ? size - 64 : i + 1)
+        mem[i] = (unsigned char) (seed + i);
+}
+
+static int filled(const unsigned char *mem, size_t size, unsigned char seed) {
+    for (size_t i = 0; i < size; i = i == 63 && size > 128 ? size - 64 : i + 1)
+        if (mem[i] != (unsigned char) (seed + i))
+            return 0;
+    return 1;
+}
@@ -0,0 +1,161 @@
+/*
+ * Checks for mem_pool_mark() and mem_pool_release_to(): releasing to a mark
+ * frees exactly what was allocated since, nested marks release inner frames
+ * first, allocations from before the mark and frees inside the frame are
+ * left alone, the pool's counters agree with mem_inspect_pool() throughout,
+ * and marks that can't be from this pool are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define NUM_KEEP        50
+#define NUM_ROUNDS      200
+#define MAX_FRAME       100
+
+/* forward declarations */
+static void check_frames(alloc_policy policy, unsigned seed);
+static void check_bad_marks();
+static void check_counters(pool_pt pool);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_frames(FIRST_FIT, 1);
+    check_frames(BEST_FIT, 2);
+    check_bad_marks();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_mark OK\n");
+
+    return 0;
+}
+
+// a pool with holes in it, then frames pushed and popped on top
+static void check_frames(alloc_policy policy, unsigned seed) {
+
+    pool_pt pool = mem_pool_open(1 << 24, policy);
+    CHECK(pool);
+
+    alloc_pt keep[NUM_KEEP];
+    for (int i = 0; i < NUM_KEEP; i++) {
+        keep[i] = mem_new_alloc(pool, 100 + rand_r(&seed) % 500);
+        CHECK(keep[i]);
+    }
+    for (int i = 0; i < NUM_KEEP; i += 2)
+        CHECK(mem_del_alloc(pool, keep[i]) == ALLOC_OK);
+
+    unsigned num_kept = pool->num_allocs;
+    size_t kept_size = pool->alloc_size;
+
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+
+        pool_mark_t outer = mem_pool_mark(pool);
+
+        alloc_pt frame[MAX_FRAME];
+        int frame_size = 20 + rand_r(&seed) % (MAX_FRAME - 20);
+        for (int i = 0; i < frame_size; i++) {
+            frame[i] = mem_new_alloc(pool, 1 + rand_r(&seed) % 300);
+            CHECK(frame[i]);
+        }
+
+        pool_mark_t inner = mem_pool_mark(pool);
+        CHECK(inner == outer + frame_size);
+        unsigned num_outer = pool->num_allocs;
+
+        for (int i = 0; i < 10; i++)
+            CHECK(mem_new_alloc(pool, 1 + rand_r(&seed) % 50));
+        // frees inside a frame don't get in the way of releasing it
+        for (int i = 0; i < frame_size; i += 3) {
+            CHECK(mem_del_alloc(pool, frame[i]) == ALLOC_OK);
+            num_outer--;
+        }
+        check_counters(pool);
+
+        CHECK(mem_pool_release_to(pool, inner) == ALLOC_OK);
+        CHECK(pool->num_allocs == num_outer);
+        check_counters(pool);
+
+        // releasing to the same mark again has nothing left to do
+        CHECK(mem_pool_release_to(pool, inner) == ALLOC_OK);
+        CHECK(pool->num_allocs == num_outer);
+
+        CHECK(mem_pool_release_to(pool, outer) == ALLOC_OK);
+        CHECK(pool->num_allocs == num_kept && pool->alloc_size == kept_size);
+        check_counters(pool);
+    }
+
+    // what was there before the first mark is still there, and can be freed
+    for (int i = 1; i < NUM_KEEP; i += 2)
+        CHECK(mem_del_alloc(pool, keep[i]) == ALLOC_OK);
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+static void check_bad_marks() {
+
+    pool_pt pool = mem_pool_open(4096, FIRST_FIT);
+    pool_pt other = mem_pool_open(4096, FIRST_FIT);
+    CHECK(pool && other);
+
+    // allocations before any mark weren't tracked, so there's no going back past them
+    alloc_pt before = mem_new_alloc(pool, 100);
+    CHECK(before);
+    CHECK(mem_pool_release_to(pool, 0) == ALLOC_FAIL);
+    CHECK(mem_last_error() == MEM_ERR_BAD_MARK);
+
+    pool_mark_t mark = mem_pool_mark(pool);
+    CHECK(mem_new_alloc(pool, 100) && mem_new_alloc(pool, 100));
+
+    // a mark from the future, or from a pool that's further along
+    CHECK(mem_pool_release_to(pool, mem_pool_mark(pool) + 1) == ALLOC_FAIL);
+    CHECK(mem_last_error() == MEM_ERR_BAD_MARK);
+    CHECK(mem_pool_release_to(other, mem_pool_mark(pool)) == ALLOC_FAIL);
+    CHECK(mem_last_error() == MEM_ERR_BAD_MARK);
+    CHECK(pool->num_allocs == 3);
+
+    // a pool with nothing allocated since can always go back to where it is
+    CHECK(mem_pool_release_to(other, 0) == ALLOC_OK);
+
+    CHECK(mem_pool_release_to(pool, mark) == ALLOC_OK);
+    CHECK(pool->num_allocs == 1 && mem_find_alloc(before->mem) == before);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+    CHECK(mem_pool_close(other) == ALLOC_OK);
+}
+
+// the counters against a walk of the segments, and no two gaps in a row
+static void check_counters(pool_pt pool) {
+
+    pool_segment_pt segments;
+    unsigned num_segments;
+    mem_inspect_pool(pool, &segments, &num_segments);
+    CHECK(segments);
+
+    unsigned num_gaps = 0, num_allocs = 0;
+    size_t total_size = 0, alloc_size = 0;
+    for (unsigned i = 0; i < num_segments; i++) {
+        total_size += segments[i].size;
+        if (segments[i].allocated) {
+            num_allocs++;
+            alloc_size += segments[i].size;
+        } else {
+            num_gaps++;
+            CHECK(i == 0 || segments[i - 1].allocated);
+        }
+    }
+
+    CHECK(total_size == pool->total_size && alloc_size == pool->alloc_size);
+    CHECK(num_gaps == pool->num_gaps && num_allocs == pool->num_allocs);
+
+    free(segments);
+}
@@ -0,0 +1,154 @@
+/*
+ * Checks for the page map: mem_pool_owner() knows every byte of every open
+ * pool and nothing else, pool store slots are reused as pools come and go,
+ * and mem_find_alloc() and mem_free_ptr() work from the data pointer alone,
+ * but only from the start of an allocation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define NUM_POOLS       100
+#define NUM_LIVE        2000
+#define NUM_OPS         50000
+
+/* forward declarations */
+static void check_owners();
+static void check_pointers();
+static void run(alloc_policy policy, unsigned seed);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_owners();
+    check_pointers();
+    run(FIRST_FIT, 1);
+    run(BEST_FIT, 2);
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_page_map OK\n");
+
+    return 0;
+}
+
+// pools of odd sizes, opened and closed in rounds so the store's slots get reused
+static void check_owners() {
+
+    pool_pt pools[NUM_POOLS];
+
+    for (int round = 0; round < 3; round++) {
+
+        for (int i = 0; i < NUM_POOLS; i++) {
+            pools[i] = mem_pool_open(100 + 37 * i, FIRST_FIT);
+            CHECK(pools[i]);
+        }
+
+        for (int i = 0; i < NUM_POOLS; i++) {
+            size_t size = pools[i]->total_size;
+            CHECK(mem_pool_owner(pools[i]->mem) == pools[i]);
+            CHECK(mem_pool_owner(pools[i]->mem + size - 1) == pools[i]);
+            // the rest of the last page isn't the pool's
+            CHECK(mem_pool_owner(pools[i]->mem + size) == NULL);
+        }
+
+        // every other one, then the rest, so there are holes in the store to fill
+        for (int i = 0; i < NUM_POOLS; i += 2)
+            CHECK(mem_pool_close(pools[i]) == ALLOC_OK);
+        for (int i = 1; i < NUM_POOLS; i += 2) {
+            CHECK(mem_pool_owner(pools[i]->mem) == pools[i]);
+            CHECK(mem_pool_close(pools[i]) == ALLOC_OK);
+        }
+    }
+
+    int local;
+    CHECK(mem_pool_owner(&local) == NULL);
+    CHECK(mem_pool_owner(NULL) == NULL);
+
+    // compact pools stay out of the page map
+    pool_pt compact = mem_pool_open_compact(1000, FIRST_FIT);
+    CHECK(compact);
+    CHECK(mem_pool_owner(compact->mem) == NULL);
+    CHECK(mem_pool_close(compact) == ALLOC_OK);
+}
+
+static void check_pointers() {
+
+    pool_pt pool = mem_pool_open(4096, BEST_FIT);
+    CHECK(pool);
+
+    alloc_pt a = mem_new_alloc(pool, 100);
+    alloc_pt b = mem_new_alloc(pool, 200);
+    CHECK(a && b);
+
+    CHECK(mem_find_alloc(a->mem) == a);
+    CHECK(mem_find_alloc(b->mem) == b);
+    CHECK(mem_find_alloc(a->mem + 1) == NULL);
+    CHECK(mem_find_alloc(b->mem + 199) == NULL);
+
+    // inside an allocation, or not in a pool at all, is not freed
+    CHECK(mem_free_ptr(a->mem + 50) == ALLOC_FAIL);
+    CHECK(mem_last_error() == MEM_ERR_NOT_FOUND);
+    int local;
+    CHECK(mem_free_ptr(&local) == ALLOC_FAIL);
+    CHECK(mem_last_error() == MEM_ERR_NOT_FOUND);
+    CHECK(pool->num_allocs == 2);
+
+    CHECK(mem_free_ptr(a->mem) == ALLOC_OK);
+    CHECK(mem_find_alloc(pool->mem) == NULL);
+    CHECK(mem_free_ptr(pool->mem) == ALLOC_FAIL);
+    CHECK(mem_free_ptr(b->mem) == ALLOC_OK);
+
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// random churn, freed by pointer or by record, with the pool's counters checked at the end
+static void run(alloc_policy policy, unsigned seed) {
+
+    static alloc_pt live[NUM_LIVE];
+    unsigned num_live = 0;
+
+    pool_pt pool = mem_pool_open(1 << 20, policy);
+    CHECK(pool);
+
+    for (int i = 0; i < NUM_OPS; i++) {
+
+        if (num_live < NUM_LIVE && (rand_r(&seed) % 100 < 55 || num_live == 0)) {
+
+            size_t size = 1 + rand_r(&seed) % (rand_r(&seed) % 10 ? 64 : 4000);
+            alloc_pt alloc = mem_new_alloc(pool, size);
+            if (!alloc)
+                continue;
+
+            CHECK(mem_pool_owner(alloc->mem) == pool);
+            CHECK(mem_pool_owner(alloc->mem + size - 1) == pool);
+            CHECK(mem_find_alloc(alloc->mem) == alloc);
+            live[num_live++] = alloc;
+
+        } else {
+
+            unsigned k = rand_r(&seed) % num_live;
+            if (rand_r(&seed) & 1)
+                CHECK(mem_free_ptr(live[k]->mem) == ALLOC_OK);
+            else
+                CHECK(mem_del_alloc(pool, live[k]) == ALLOC_OK);
+            live[k] = live[--num_live];
+        }
+    }
+
+    CHECK(pool->num_allocs == num_live);
+    while (num_live)
+        CHECK(mem_free_ptr(live[--num_live]->mem) == ALLOC_OK);
+
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
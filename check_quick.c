@@ -0,0 +1,240 @@
+/*
+ * Checks that quick lists don't throw off a pool's accounting: with them
+ * on, num_allocs, num_gaps and alloc_size always agree with what
+ * mem_inspect_pool() walks, through marks, clones and zeroed allocations,
+ * and blocks parked on a list still come back to a waiter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define POOL_SIZE       (1 << 20)
+#define NUM_LIVE        5000
+#define NUM_OPS         100000
+
+/* forward declarations */
+static void run(pool_pt pool, unsigned seed, int cloneable);
+static void check_segments(pool_pt pool, unsigned num_live);
+static void check_fill(pool_pt pool);
+static void check_wait();
+static void *free_half(void *arg);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    const alloc_policy policies[] = {FIRST_FIT, BEST_FIT, ADAPTIVE};
+
+    for (unsigned i = 0; i < 3; i++) {
+        for (int compact = 0; compact < 2; compact++) {
+
+            pool_pt pool = compact ? mem_pool_open_compact(POOL_SIZE, policies[i])
+                                   : mem_pool_open(POOL_SIZE, policies[i]);
+            CHECK(pool);
+            CHECK(mem_pool_enable_quick_lists(pool) == ALLOC_OK);
+            CHECK(mem_pool_enable_quick_lists(pool) == ALLOC_CALLED_AGAIN);
+
+            run(pool, i + 1, !compact);
+            check_fill(pool);
+
+            CHECK(mem_pool_close(pool) == ALLOC_OK);
+        }
+    }
+
+    check_wait();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_quick OK\n");
+
+    return 0;
+}
+
+// random small and big allocations, some zeroed, frees, and marks released
+static void run(pool_pt pool, unsigned seed, int cloneable) {
+
+    static alloc_pt live[NUM_LIVE];
+    unsigned num_live = 0;
+    pool_mark_t mark = 0;
+    int marked = -1;            // num_live at the mark, -1 if there is none
+
+    for (int i = 0; i < NUM_OPS; i++) {
+
+        int op = rand_r(&seed) % 1000;
+
+        if (op == 0 && marked < 0) {
+
+            mark = mem_pool_mark(pool);
+            marked = num_live;
+
+        } else if (op == 1 && marked >= 0) {
+
+            CHECK(mem_pool_release_to(pool, mark) == ALLOC_OK);
+            num_live = marked;
+            marked = -1;
+            check_segments(pool, num_live);
+
+        } else if (num_live < NUM_LIVE && (rand_r(&seed) % 100 < 52 || num_live == 0)) {
+
+            size_t size = rand_r(&seed) % 4 ? 16 * (1 + rand_r(&seed) % 8)
+                                            : 1 + rand_r(&seed) % (rand_r(&seed) % 10 ? 1200 : 30000);
+            int zeroed = rand_r(&seed) % 5 == 0;
+
+            alloc_pt alloc = zeroed ? mem_new_alloc_zeroed(pool, size) : mem_new_alloc(pool, size);
+            if (!alloc)
+                continue;
+
+            CHECK(alloc->size == size);
+            CHECK(alloc->mem >= pool->mem && alloc->mem + size <= pool->mem + POOL_SIZE);
+            for (size_t j = 0; zeroed && j < size; j++)
+                CHECK(alloc->mem[j] == 0);
+
+            memset(alloc->mem, 0x5a, size);
+            live[num_live++] = alloc;
+
+        } else if (num_live) {
+
+            // only what came after the mark, while there is one, so the mark can still release it
+            unsigned first = marked >= 0 ? (unsigned) marked : 0;
+            if (num_live == first)
+                continue;
+            unsigned k = first + rand_r(&seed) % (num_live - first);
+
+            if (cloneable && pool->policy != ADAPTIVE && rand_r(&seed) & 1)
+                CHECK(mem_free_ptr(live[k]->mem) == ALLOC_OK);
+            else
+                CHECK(mem_del_alloc(pool, live[k]) == ALLOC_OK);
+
+            // keep the order, the mark is a count of the oldest ones
+            memmove(&live[k], &live[k + 1], sizeof(alloc_pt) * (num_live - k - 1));
+            num_live--;
+        }
+
+        if (i % 997 == 0)
+            check_segments(pool, num_live);
+    }
+
+    // a clone starts out with the blocks on the lists merged back
+    if (cloneable) {
+        pool_pt clone = mem_pool_clone(pool);
+        CHECK(clone);
+        CHECK(clone->num_allocs == pool->num_allocs && clone->num_gaps == pool->num_gaps);
+        check_segments(clone, num_live);
+        CHECK(mem_pool_close(clone) == ALLOC_OK);
+    }
+
+    while (num_live)
+        CHECK(mem_del_alloc(pool, live[--num_live]) == ALLOC_OK);
+
+    check_segments(pool, 0);
+    CHECK(pool->num_gaps == 1);
+}
+
+// the counters agree with the segments, and no two gaps are next to each other
+static void check_segments(pool_pt pool, unsigned num_live) {
+
+    unsigned num_gaps = pool->num_gaps;
+    pool_segment_pt segments;
+    unsigned num_segments;
+    mem_inspect_pool(pool, &segments, &num_segments);
+    CHECK(pool->num_gaps == num_gaps);
+
+    size_t total = 0, alloc_size = 0;
+    unsigned allocs = 0, gaps = 0;
+    int prev_gap = 0;
+
+    for (unsigned i = 0; i < num_segments; i++) {
+        CHECK(segments[i].size);
+        total += segments[i].size;
+        if (segments[i].allocated) {
+            allocs++;
+            alloc_size += segments[i].size;
+            prev_gap = 0;
+        } else {
+            gaps++;
+            CHECK(!prev_gap);
+            prev_gap = 1;
+        }
+    }
+
+    CHECK(total == pool->total_size);
+    CHECK(allocs == pool->num_allocs && allocs == num_live);
+    CHECK(gaps == pool->num_gaps);
+    CHECK(alloc_size == pool->alloc_size);
+
+    free(segments);
+}
+
+// fill with one size, free every other one and then the rest, and get the whole pool back
+static void check_fill(pool_pt pool) {
+
+    static alloc_pt all[POOL_SIZE / 16];
+    unsigned count = 0;
+    alloc_pt alloc;
+
+    while ((alloc = mem_new_alloc(pool, 16)))
+        all[count++] = alloc;
+    CHECK(pool->num_gaps == 0);
+
+    for (unsigned i = 0; i < count; i += 2)
+        CHECK(mem_del_alloc(pool, all[i]) == ALLOC_OK);
+    CHECK(pool->num_gaps == (count + 1) / 2);
+
+    for (unsigned i = 1; i < count; i += 2)
+        CHECK(mem_del_alloc(pool, all[i]) == ALLOC_OK);
+    CHECK(pool->num_gaps == 1 && pool->num_allocs == 0);
+
+    alloc = mem_new_alloc(pool, POOL_SIZE);
+    CHECK(alloc && pool->num_gaps == 0);
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+}
+
+static pool_pt wait_pool;
+static alloc_pt wait_allocs[64];
+
+// a waiter for the whole pool, with half of it parked on a quick list and the rest freed while it waits
+static void check_wait() {
+
+    wait_pool = mem_pool_open(64 * 64, BEST_FIT);
+    CHECK(wait_pool);
+    CHECK(mem_pool_share(wait_pool) == ALLOC_OK);
+    CHECK(mem_pool_enable_quick_lists(wait_pool) == ALLOC_OK);
+
+    for (int i = 0; i < 64; i++) {
+        wait_allocs[i] = mem_new_alloc(wait_pool, 64);
+        CHECK(wait_allocs[i]);
+    }
+
+    for (int i = 0; i < 64; i += 2)
+        CHECK(mem_del_alloc(wait_pool, wait_allocs[i]) == ALLOC_OK);
+    for (int i = 0; i < 32; i++)
+        wait_allocs[i] = wait_allocs[2 * i + 1];
+
+    pthread_t freer;
+    pthread_create(&freer, NULL, free_half, NULL);
+
+    alloc_pt all = mem_new_alloc_wait(wait_pool, 64 * 64, 2000);
+    pthread_join(freer, NULL);
+
+    CHECK(all && wait_pool->num_gaps == 0 && wait_pool->num_allocs == 1);
+    CHECK(mem_del_alloc(wait_pool, all) == ALLOC_OK);
+    CHECK(mem_pool_close(wait_pool) == ALLOC_OK);
+}
+
+static void *free_half(void *arg) {
+
+    usleep(50000);
+    for (int i = 0; i < 32; i++)
+        CHECK(mem_del_alloc(wait_pool, wait_allocs[i]) == ALLOC_OK);
+
+    return NULL;
+}
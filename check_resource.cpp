@@ -0,0 +1,173 @@
+/*
+ * Checks for the C++ adapters in mem_pool_resource.hpp: containers on a
+ * pool give every block back, over-aligned and misaligned requests come
+ * back aligned and are freed again, equality follows the pool, and a full
+ * pool throws std::bad_alloc.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mem_pool.h"
+#include "mem_pool_resource.hpp"
+#include "check.h"
+
+/* forward declarations */
+static void check_containers(alloc_policy policy);
+static void check_alignment();
+static void check_equality();
+static void check_full();
+
+struct alignas(64) line {
+    char bytes[64];
+};
+
+/* main */
+int main() {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_containers(BEST_FIT);
+    check_containers(FIRST_FIT);
+    check_alignment();
+    check_equality();
+    check_full();
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    std::printf("check_resource OK\n");
+
+    return 0;
+}
+
+static void check_containers(alloc_policy policy) {
+
+    pool_pt pool = mem_pool_open(16 << 20, policy);
+    CHECK(pool);
+
+    {
+        mem::pool_resource res(pool);
+        std::pmr::vector<int> v(&res);
+        std::pmr::unordered_map<int, std::pmr::string> m(&res);
+        std::pmr::list<line> l(&res);
+
+        for (int i = 0; i < 20000; i++) {
+            v.push_back(i);
+            m.emplace(i, std::pmr::string(i % 50, 'x'));
+            if (i % 4 == 0)
+                l.emplace_back();
+        }
+        for (int i = 0; i < 20000; i += 2)
+            m.erase(i);
+        for (const line &x : l)
+            CHECK(reinterpret_cast<std::uintptr_t>(&x) % alignof(line) == 0);
+
+        CHECK(v[12345] == 12345 && m.size() == 10000 && m.at(49).size() == 49);
+        CHECK(pool->num_allocs > 0);
+    }
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+
+    {
+        using alloc = mem::pool_allocator<std::pair<const int, int>>;
+        std::map<int, int, std::less<int>, alloc> m{alloc(pool)};
+        std::vector<long, mem::pool_allocator<long>> v{mem::pool_allocator<long>(pool)};
+        for (int i = 0; i < 10000; i++) {
+            m[i] = i;
+            v.push_back(i);
+        }
+        CHECK(m.size() == 10000 && v.back() == 9999);
+    }
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// every alignment up to a page, with odd-sized C allocations in between so blocks start misaligned
+static void check_alignment() {
+
+    pool_pt pool = mem_pool_open(16 << 20, BEST_FIT);
+    CHECK(pool);
+    mem::pool_resource res(pool);
+
+    std::vector<std::pair<void *, std::size_t>> blocks;
+    std::vector<alloc_pt> odd;
+
+    for (int round = 0; round < 50; round++) {
+        for (std::size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+            alloc_pt alloc = mem_new_alloc(pool, 1 + round % 15);
+            CHECK(alloc);
+            odd.push_back(alloc);
+
+            std::size_t bytes = 1 + (round * 37) % 300;
+            void *ptr = res.allocate(bytes, alignment);
+            CHECK(reinterpret_cast<std::uintptr_t>(ptr) % alignment == 0);
+            std::memset(ptr, 0x5a, bytes);
+            blocks.emplace_back(ptr, alignment);
+        }
+    }
+
+    for (auto &block : blocks)
+        res.deallocate(block.first, 1, block.second);
+    for (alloc_pt alloc : odd)
+        CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+static void check_equality() {
+
+    pool_pt a = mem_pool_open(4096, BEST_FIT);
+    pool_pt b = mem_pool_open(4096, BEST_FIT);
+    CHECK(a && b);
+
+    mem::pool_resource res_a(a), res_a2(a), res_b(b);
+    CHECK(res_a == res_a2);
+    CHECK(res_a != res_b);
+    CHECK(res_a != *std::pmr::new_delete_resource());
+
+    mem::pool_allocator<int> int_a(a);
+    mem::pool_allocator<double> double_a(int_a);
+    CHECK(int_a == double_a && double_a.pool() == a);
+    CHECK(int_a != mem::pool_allocator<int>(b));
+
+    CHECK(mem_pool_close(a) == ALLOC_OK);
+    CHECK(mem_pool_close(b) == ALLOC_OK);
+}
+
+static void check_full() {
+
+    pool_pt pool = mem_pool_open(4096, BEST_FIT);
+    CHECK(pool);
+    mem::pool_resource res(pool);
+
+    bool thrown = false;
+    try {
+        void *ptr = res.allocate(8192, 16);
+        res.deallocate(ptr, 8192, 16);
+    } catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    thrown = false;
+    try {
+        mem::pool_allocator<int>(pool).allocate(SIZE_MAX / 2);
+    } catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    CHECK(pool->num_allocs == 0);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
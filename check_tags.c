@@ -0,0 +1,130 @@
+/*
+ * Checks for tagged allocations: every free takes its bytes off the tag it
+ * was made under, mem_pool_top_tags() ranks tags by live bytes and keeps
+ * their peaks, tags past MEM_POOL_MAX_TAG are refused, and
+ * mem_pool_dump_tags() writes one parsable line per tag, starting a new
+ * rate window each time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define NUM_ALLOCS      300
+#define BIG_TAG         40000
+#define SMALL_TAG       7
+
+/* forward declarations */
+static void check_stats(pool_pt pool);
+static void check_dump(pool_pt pool);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(1 << 20, BEST_FIT);
+    CHECK(pool);
+
+    check_stats(pool);
+    check_dump(pool);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_tags OK\n");
+
+    return 0;
+}
+
+// two thirds under one tag, a third under the other, then every other one freed
+static void check_stats(pool_pt pool) {
+
+    alloc_pt allocs[NUM_ALLOCS];
+
+    for (int i = 0; i < NUM_ALLOCS; i++) {
+        allocs[i] = mem_new_alloc_tagged(pool, 16 + i, i % 3 ? SMALL_TAG : BIG_TAG);
+        CHECK(allocs[i]);
+    }
+    CHECK(mem_new_alloc(pool, 100));
+
+    for (int i = 0; i < NUM_ALLOCS; i += 2) {
+        if (i % 4)
+            CHECK(mem_del_alloc(pool, allocs[i]) == ALLOC_OK);
+        else
+            CHECK(mem_free_ptr(allocs[i]->mem) == ALLOC_OK);
+    }
+
+    CHECK(mem_new_alloc_tagged(pool, 10, MEM_POOL_MAX_TAG + 1) == NULL);
+    CHECK(mem_last_error() == MEM_ERR_BAD_TAG);
+
+    // the bytes asked for, not the granules handed out
+    size_t small_live = 0, small_peak = 0, big_live = 0, big_peak = 0;
+    for (int i = 0; i < NUM_ALLOCS; i++) {
+        size_t *live = i % 3 ? &small_live : &big_live;
+        size_t *peak = i % 3 ? &small_peak : &big_peak;
+        *peak += 16 + i;
+        if (i % 2)
+            *live += 16 + i;
+    }
+
+    tag_stats_t stats[8];
+    CHECK(mem_pool_top_tags(pool, stats, 8) == 3);
+
+    CHECK(stats[0].tag == SMALL_TAG);
+    CHECK(stats[0].live_bytes == small_live && stats[0].peak_bytes == small_peak);
+    CHECK(stats[0].live_count == 100 && stats[0].allocs == 200);
+
+    CHECK(stats[1].tag == BIG_TAG);
+    CHECK(stats[1].live_bytes == big_live && stats[1].peak_bytes == big_peak);
+    CHECK(stats[1].live_count == 50 && stats[1].allocs == 100);
+
+    // untagged is tag 0
+    CHECK(stats[2].tag == 0 && stats[2].live_bytes == 100 && stats[2].live_count == 1);
+    CHECK(stats[0].alloc_rate > 0);
+
+    // fewer than there are, the biggest ones
+    CHECK(mem_pool_top_tags(pool, stats, 1) == 1 && stats[0].tag == SMALL_TAG);
+}
+
+static void check_dump(pool_pt pool) {
+
+    FILE *out = tmpfile();
+    CHECK(out);
+
+    mem_pool_dump_tags(pool, out);
+    mem_pool_dump_tags(pool, out);
+    rewind(out);
+
+    char line[256];
+    unsigned num_tags = 0, tags[8], live_count[8];
+    double rate[8];
+
+    for (int dump = 0; dump < 2; dump++) {
+
+        unsigned num_allocs, num_header_tags;
+        CHECK(fgets(line, sizeof(line), out));
+        CHECK(sscanf(line, "mem_pool pool=%*p total_size=%*u alloc_size=%*u num_allocs=%u num_gaps=%*u tags=%u",
+                     &num_allocs, &num_header_tags) == 2);
+        CHECK(num_allocs == pool->num_allocs && num_header_tags == 3);
+
+        for (num_tags = 0; num_tags < num_header_tags; num_tags++) {
+            CHECK(fgets(line, sizeof(line), out));
+            CHECK(sscanf(line, "mem_pool_tag pool=%*p tag=%u live_bytes=%*u live_count=%u peak_bytes=%*u allocs=%*u rate=%lf",
+                         &tags[num_tags], &live_count[num_tags], &rate[num_tags]) == 3);
+        }
+    }
+    CHECK(fgets(line, sizeof(line), out) == NULL);
+    fclose(out);
+
+    // in tag order, and the second dump's window has no allocations in it
+    CHECK(num_tags == 3 && tags[0] == 0 && tags[1] == SMALL_TAG && tags[2] == BIG_TAG);
+    CHECK(live_count[0] == 1 && live_count[1] == 100 && live_count[2] == 50);
+    CHECK(rate[0] == 0 && rate[1] == 0 && rate[2] == 0);
+}
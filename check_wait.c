@@ -0,0 +1,212 @@
+/*
+ * Checks for mem_new_alloc_wait() on a shared pool: the errors it gives
+ * up with, that waiters are served in the order they got in line, and a
+ * producer/consumer run where the producers only get memory back from
+ * the consumers' frees.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define NUM_PRODUCERS   4
+#define NUM_ALLOCS      20000
+#define QUEUE_SIZE      64
+
+/* forward declarations */
+static double now_ms();
+static void check_errors();
+static void check_order();
+static void check_producers(alloc_policy policy, int maintenance);
+static void *waiter(void *arg);
+static void *producer(void *arg);
+static void *consumer(void *arg);
+
+/* shared with the threads */
+static pool_pt pool;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static unsigned served;         // waiters served so far
+static alloc_pt queue[QUEUE_SIZE];
+static unsigned queue_head, queue_tail;
+static int producers_done;
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    check_errors();
+    check_order();
+    check_producers(BEST_FIT, 0);
+    check_producers(ADAPTIVE, 0);
+    check_producers(FIRST_FIT, 1);
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_wait OK\n");
+
+    return 0;
+}
+
+static double now_ms() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void check_errors() {
+
+    pool = mem_pool_open(64 * 1024, BEST_FIT);
+    CHECK(pool);
+
+    // nothing could ever free anything while an unshared pool waits
+    CHECK(mem_new_alloc_wait(pool, 10, -1) == NULL);
+    CHECK(mem_last_error() == MEM_ERR_UNSUPPORTED);
+
+    CHECK(mem_pool_share(pool) == ALLOC_OK);
+    CHECK(mem_pool_share(pool) == ALLOC_CALLED_AGAIN);
+
+    alloc_pt big = mem_new_alloc_wait(pool, 60000, 0);
+    CHECK(big);
+
+    // a bounded wait gives up after about its timeout
+    double start = now_ms();
+    CHECK(mem_new_alloc_wait(pool, 10000, 50) == NULL);
+    CHECK(mem_last_error() == MEM_ERR_TIMEOUT);
+    CHECK(now_ms() - start >= 45);
+
+    // no wait at all, and a size that could never fit, fail right away
+    CHECK(mem_new_alloc_wait(pool, 10000, 0) == NULL);
+    CHECK(mem_new_alloc_wait(pool, 1 << 20, -1) == NULL);
+
+    CHECK(mem_del_alloc(pool, big) == ALLOC_OK);
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+static void check_order() {
+
+    pool = mem_pool_open(1000, FIRST_FIT);
+    CHECK(pool);
+    CHECK(mem_pool_share(pool) == ALLOC_OK);
+
+    alloc_pt full = mem_new_alloc(pool, 900);
+    CHECK(full);
+    served = 0;
+
+    // the small request fits already, but it got in line behind the big one
+    pthread_t first, second;
+    pthread_create(&first, NULL, waiter, (void *) 500);
+    usleep(20000);
+    pthread_create(&second, NULL, waiter, (void *) 50);
+    usleep(50000);
+
+    pthread_mutex_lock(&lock);
+    CHECK(served == 0);
+    pthread_mutex_unlock(&lock);
+
+    CHECK(mem_del_alloc(pool, full) == ALLOC_OK);
+
+    // the first one served gets the front of the pool
+    void *first_alloc, *second_alloc;
+    pthread_join(first, &first_alloc);
+    pthread_join(second, &second_alloc);
+    CHECK(((alloc_pt) first_alloc)->mem == pool->mem);
+    CHECK(((alloc_pt) second_alloc)->mem == pool->mem + 500);
+
+    CHECK(served == 2 && pool->num_allocs == 2);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+static void check_producers(alloc_policy policy, int maintenance) {
+
+    pool = mem_pool_open(64 * 1024, policy);
+    CHECK(pool);
+    CHECK(mem_pool_share(pool) == ALLOC_OK);
+    if (maintenance)
+        CHECK(mem_pool_start_maintenance(pool) == ALLOC_OK);
+
+    queue_head = queue_tail = 0;
+    producers_done = 0;
+
+    pthread_t producers[NUM_PRODUCERS], consumers[NUM_PRODUCERS];
+    for (long i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_create(&producers[i], NULL, producer, (void *) i);
+        pthread_create(&consumers[i], NULL, consumer, NULL);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+
+    pthread_mutex_lock(&lock);
+    producers_done = 1;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(consumers[i], NULL);
+
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// waits for its size, returns the allocation
+static void *waiter(void *arg) {
+
+    alloc_pt alloc = mem_new_alloc_wait(pool, (size_t) arg, 2000);
+    CHECK(alloc);
+
+    pthread_mutex_lock(&lock);
+    served++;
+    pthread_mutex_unlock(&lock);
+
+    return alloc;
+}
+
+static void *producer(void *arg) {
+
+    unsigned seed = (unsigned) (size_t) arg;
+
+    for (int i = 0; i < NUM_ALLOCS; i++) {
+
+        alloc_pt alloc = mem_new_alloc_wait(pool, 64 + rand_r(&seed) % 4000, -1);
+        CHECK(alloc);
+        alloc->mem[0] = (char) seed;
+
+        pthread_mutex_lock(&lock);
+        while (queue_tail - queue_head == QUEUE_SIZE)
+            pthread_cond_wait(&changed, &lock);
+        queue[queue_tail++ % QUEUE_SIZE] = alloc;
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+
+    for (;;) {
+
+        pthread_mutex_lock(&lock);
+        while (queue_tail == queue_head && !producers_done)
+            pthread_cond_wait(&changed, &lock);
+        if (queue_tail == queue_head) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        alloc_pt alloc = queue[queue_head++ % QUEUE_SIZE];
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+
+        CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+    }
+}
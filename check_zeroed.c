@@ -0,0 +1,185 @@
+/*
+ * Checks for mem_new_alloc_zeroed(): every allocation it returns reads as
+ * zero, whatever the pool wrote there before, in every kind of pool the
+ * known-zero tracking has its own rule for (fresh pages, trimmed pages,
+ * a clone's file, a memfd-backed pool, a compact pool's malloc() block).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mem_pool.h"
+#include "check.h"
+
+#define NUM_LIVE        3000
+#define NUM_OPS         50000
+
+/* forward declarations */
+static void run(pool_pt pool, unsigned seed, size_t max_size);
+static void check_big(pool_pt pool, size_t size);
+static void check_clone_big(pool_pt pool, size_t size);
+static void wait_for_trim();
+static int is_zero(const char *mem, size_t size);
+
+/* main */
+int main(int argc, char *argv[]) {
+
+    const size_t POOL_SIZE = 16 << 20;
+
+    alloc_status status = mem_init();
+    CHECK(status == ALLOC_OK);
+
+    // fresh pages, then trimmed ones
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    CHECK(pool);
+    CHECK(mem_pool_start_maintenance(pool) == ALLOC_OK);
+    run(pool, 1, 2000);
+    wait_for_trim();
+    run(pool, 2, 2000);
+
+    // a clone reads the pool's old data through its file, and so does the pool itself after
+    pool_pt clone = mem_pool_clone(pool);
+    CHECK(clone);
+    run(clone, 3, 4000);
+    run(pool, 4, 8000);
+    check_big(clone, POOL_SIZE / 2);
+    CHECK(mem_pool_close(clone) == ALLOC_OK);
+    check_clone_big(pool, POOL_SIZE / 2);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    // a memfd-backed pool, trimmed while its view is still shared, then cloned
+    pool = mem_pool_open_cow(POOL_SIZE, FIRST_FIT);
+    CHECK(pool);
+    CHECK(mem_pool_start_maintenance(pool) == ALLOC_OK);
+    check_big(pool, POOL_SIZE / 2);
+    run(pool, 5, 2000);
+    wait_for_trim();
+    check_clone_big(pool, POOL_SIZE / 2);
+    clone = mem_pool_clone(pool);
+    CHECK(clone);
+    run(clone, 6, 2000);
+    run(pool, 7, 2000);
+    CHECK(mem_pool_close(clone) == ALLOC_OK);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    // nothing in malloc()'s block is known to be zero
+    pool = mem_pool_open_compact(1 << 20, FIRST_FIT);
+    CHECK(pool);
+    run(pool, 8, 500);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    // big enough to give whole pages back instead of clearing them
+    pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    CHECK(pool);
+    check_big(pool, POOL_SIZE / 2);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    status = mem_free();
+    CHECK(status == ALLOC_OK);
+
+    printf("check_zeroed OK\n");
+
+    return 0;
+}
+
+// random allocations, zeroed or not, frees, and marks released with fresh data under them
+static void run(pool_pt pool, unsigned seed, size_t max_size) {
+
+    static alloc_pt live[NUM_LIVE];
+    unsigned num_live = 0;
+
+    for (int i = 0; i < NUM_OPS; i++) {
+
+        int op = rand_r(&seed) % 100;
+
+        if (num_live < NUM_LIVE && op < 52) {
+
+            size_t size = 1 + rand_r(&seed) % (rand_r(&seed) % 20 ? max_size : max_size * 64);
+            if (size > pool->total_size / 4)
+                size = pool->total_size / 4;
+
+            int zeroed = rand_r(&seed) & 1;
+            alloc_pt alloc = zeroed ? mem_new_alloc_zeroed(pool, size) : mem_new_alloc(pool, size);
+            if (!alloc)
+                continue;
+
+            CHECK(!zeroed || is_zero(alloc->mem, size));
+            memset(alloc->mem, 0xAA, size);
+            live[num_live++] = alloc;
+
+        } else if (num_live && op < 98) {
+
+            unsigned k = rand_r(&seed) % num_live;
+            CHECK(mem_del_alloc(pool, live[k]) == ALLOC_OK);
+            live[k] = live[--num_live];
+
+        } else {
+
+            pool_mark_t mark = mem_pool_mark(pool);
+            for (int j = 0; j < 5; j++) {
+                alloc_pt alloc = mem_new_alloc(pool, 1 + rand_r(&seed) % 300);
+                if (alloc)
+                    memset(alloc->mem, 0x55, alloc->size);
+            }
+            CHECK(mem_pool_release_to(pool, mark) == ALLOC_OK);
+        }
+    }
+
+    while (num_live)
+        CHECK(mem_del_alloc(pool, live[--num_live]) == ALLOC_OK);
+
+    CHECK(pool->num_allocs == 0 && pool->num_gaps == 1);
+}
+
+// dirty most of the pool, free it and get it back zeroed
+static void check_big(pool_pt pool, size_t size) {
+
+    alloc_pt alloc = mem_new_alloc(pool, size);
+    CHECK(alloc);
+    memset(alloc->mem, 1, size);
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+
+    alloc = mem_new_alloc_zeroed(pool, size);
+    CHECK(alloc && is_zero(alloc->mem, size));
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+}
+
+// clone with dirty data live, so it's in the file, then free it and get it back zeroed on both sides
+static void check_clone_big(pool_pt pool, size_t size) {
+
+    alloc_pt alloc = mem_new_alloc(pool, size);
+    CHECK(alloc);
+    memset(alloc->mem, 1, size);
+    size_t offset = alloc->mem - pool->mem;
+
+    pool_pt clone = mem_pool_clone(pool);
+    CHECK(clone);
+
+    alloc_pt clone_alloc = mem_find_alloc(clone->mem + offset);
+    CHECK(clone_alloc && clone_alloc->mem[size - 1] == 1);
+    CHECK(mem_del_alloc(clone, clone_alloc) == ALLOC_OK);
+    clone_alloc = mem_new_alloc_zeroed(clone, size);
+    CHECK(clone_alloc && is_zero(clone_alloc->mem, size));
+
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+    alloc = mem_new_alloc_zeroed(pool, size);
+    CHECK(alloc && is_zero(alloc->mem, size));
+    CHECK(mem_del_alloc(pool, alloc) == ALLOC_OK);
+
+    CHECK(mem_pool_close(clone) == ALLOC_OK);
+}
+
+// the worker trims once the pool has been idle for a while
+static void wait_for_trim() {
+    struct timespec wait = {0, 300 * 1000 * 1000};
+    nanosleep(&wait, NULL);
+}
+
+static int is_zero(const char *mem, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        if (mem[i])
+            return 0;
+    return 1;
+}
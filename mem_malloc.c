@@ -0,0 +1,471 @@
+/*
+* malloc() and friends on top of mem_pool, for unmodified programs:
+*
+*     LD_PRELOAD=./libmem_pool_malloc.so some_program
+*
+* Small requests share a few big BEST_FIT arenas, big ones get a pool of their
+* own. free() finds the pool and the allocation through the page map, so it
+* never has to be told which pool a pointer came from.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "mem_pool.h"
+
+// the only symbols this library exports; its copy of mem_pool is built hidden, so a
+// program that uses mem_pool itself keeps its own pool store and page map
+#define _MEM_MALLOC_EXPORT __attribute__((visibility("default")))
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+
+#define _MEM_MALLOC_ALIGNMENT							16
+#define _MEM_MALLOC_ARENA_SIZE							(64 << 20)
+#define _MEM_MALLOC_MAX_ARENAS							1024
+#define _MEM_MALLOC_LARGE_SIZE							(1 << 20)
+
+static const size_t     MEM_MALLOC_ALIGNMENT = _MEM_MALLOC_ALIGNMENT;  // every pool size and allocation size is a multiple
+static const size_t     MEM_MALLOC_ARENA_SIZE = _MEM_MALLOC_ARENA_SIZE;
+static const size_t     MEM_MALLOC_LARGE_SIZE = _MEM_MALLOC_LARGE_SIZE; // this and up get a pool of their own
+static const uint64_t   MEM_MALLOC_ALIGNED_MAGIC = 0x6D656D5F616C6967ULL;
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+
+// sits right in front of a posix_memalign() result that is not the start of its allocation
+typedef struct _aligned_hdr {
+	uint64_t magic;
+	char *base;
+} aligned_hdr_t, *aligned_hdr_pt;
+
+
+
+/***********/
+/*         */
+/* Globals */
+/*         */
+/***********/
+
+// glibc's own allocator, still reachable under these names
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+// one lock for everything, mem_pool itself is not thread safe
+static pthread_mutex_t mem_malloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// set while this thread is inside mem_pool, whose own malloc() calls (and
+// those of anything it calls, like dlsym() or qsort()) must go straight to glibc
+static __thread int mem_malloc_busy __attribute__((tls_model("initial-exec")));
+
+static int mem_malloc_ready = 0; // 0 - not yet, 1 - pools, -1 - mem_init() failed, glibc only
+static size_t (*libc_usable_size)(void *ptr) = NULL;
+
+static pool_pt arenas[_MEM_MALLOC_MAX_ARENAS];
+static unsigned num_arenas = 0;
+static unsigned cur_arena = 0;
+
+
+
+/********************************************/
+/*                                          */
+/* Forward declarations of static functions */
+/*                                          */
+/********************************************/
+static void _mem_malloc_enter();
+static void _mem_malloc_leave();
+static void _mem_malloc_init();
+static void _mem_malloc_lock();
+static void _mem_malloc_unlock();
+static void *_mem_malloc_alloc(size_t size, int zeroed);
+static alloc_pt _mem_malloc_new(pool_pt pool, size_t size, int zeroed);
+static void *_mem_malloc_libc(size_t size, int zeroed);
+static void *_mem_malloc_aligned(size_t alignment, size_t size);
+static alloc_pt _mem_malloc_find(pool_pt pool, void *ptr, char **base);
+static void _mem_malloc_release(pool_pt pool, void *ptr);
+
+
+
+/****************************************/
+/*                                      */
+/* Definitions of user-facing functions */
+/*                                      */
+/****************************************/
+_MEM_MALLOC_EXPORT void *malloc(size_t size) {
+
+	if (mem_malloc_busy)
+		return __libc_malloc(size);
+
+	_mem_malloc_enter();
+	void *ptr = _mem_malloc_alloc(size, 0);
+	_mem_malloc_leave();
+
+	return ptr;
+
+}
+
+
+_MEM_MALLOC_EXPORT void free(void *ptr) {
+
+	if (!ptr)
+		return;
+
+	if (mem_malloc_busy) {
+		__libc_free(ptr);
+		return;
+	}
+
+	_mem_malloc_enter();
+	pool_pt pool = mem_pool_owner(ptr);
+	if (pool)
+		_mem_malloc_release(pool, ptr);
+	_mem_malloc_leave();
+
+	// not ours, it came from glibc before we were loaded or through a fallback
+	if (!pool)
+		__libc_free(ptr);
+
+}
+
+
+_MEM_MALLOC_EXPORT void *calloc(size_t nmemb, size_t size) {
+
+	if (mem_malloc_busy)
+		return __libc_calloc(nmemb, size);
+
+	size_t bytes;
+	if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// the pools clear only what may have been written before, fresh pool memory is zero already
+	_mem_malloc_enter();
+	void *ptr = _mem_malloc_alloc(bytes, 1);
+	_mem_malloc_leave();
+
+	return ptr;
+
+}
+
+
+_MEM_MALLOC_EXPORT void *realloc(void *ptr, size_t size) {
+
+	if (mem_malloc_busy)
+		return __libc_realloc(ptr, size);
+
+	if (!ptr)
+		return malloc(size);
+
+	if (!size) {
+		free(ptr);
+		return NULL;
+	}
+
+	_mem_malloc_enter();
+
+	pool_pt pool = mem_pool_owner(ptr);
+	char *base = NULL;
+	alloc_pt alloc = pool ? _mem_malloc_find(pool, ptr, &base) : NULL;
+
+	if (!alloc) {
+		_mem_malloc_leave();
+		return __libc_realloc(ptr, size);
+	}
+
+	// keep the block if the new size fits and doesn't waste more than half of it
+	size_t usable = alloc->size - ((char *)ptr - base);
+	if (size <= usable && size >= usable / 2) {
+		_mem_malloc_leave();
+		return ptr;
+	}
+
+	void *new_ptr = _mem_malloc_alloc(size, 0);
+	if (new_ptr) {
+		memcpy(new_ptr, ptr, size < usable ? size : usable);
+		_mem_malloc_release(pool, ptr);
+	}
+
+	_mem_malloc_leave();
+
+	return new_ptr;
+
+}
+
+
+_MEM_MALLOC_EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+
+	if (!alignment || (alignment & (alignment - 1)) || alignment % sizeof(void *))
+		return EINVAL;
+
+	if (mem_malloc_busy) {
+		*memptr = __libc_memalign(alignment, size);
+		return *memptr ? 0 : ENOMEM;
+	}
+
+	_mem_malloc_enter();
+	void *ptr = _mem_malloc_aligned(alignment, size);
+	_mem_malloc_leave();
+
+	if (!ptr)
+		return ENOMEM;
+
+	*memptr = ptr;
+	return 0;
+
+}
+
+
+_MEM_MALLOC_EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+
+	void *ptr = NULL;
+	int error = posix_memalign(&ptr, alignment < sizeof(void *) ? sizeof(void *) : alignment, size);
+
+	if (error)
+		errno = error;
+
+	return ptr;
+
+}
+
+
+_MEM_MALLOC_EXPORT void *memalign(size_t alignment, size_t size) {
+
+	return aligned_alloc(alignment, size);
+
+}
+
+
+_MEM_MALLOC_EXPORT size_t malloc_usable_size(void *ptr) {
+
+	if (!ptr)
+		return 0;
+
+	if (mem_malloc_busy)
+		return libc_usable_size ? libc_usable_size(ptr) : 0;
+
+	_mem_malloc_enter();
+
+	pool_pt pool = mem_pool_owner(ptr);
+	char *base = NULL;
+	alloc_pt alloc = pool ? _mem_malloc_find(pool, ptr, &base) : NULL;
+	size_t usable = alloc ? alloc->size - ((char *)ptr - base) : 0;
+
+	_mem_malloc_leave();
+
+	if (!pool)
+		return libc_usable_size ? libc_usable_size(ptr) : 0;
+
+	return usable;
+
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static void _mem_malloc_enter() {
+
+	pthread_mutex_lock(&mem_malloc_lock);
+	mem_malloc_busy = 1;
+
+	if (!mem_malloc_ready)
+		_mem_malloc_init();
+
+}
+
+static void _mem_malloc_leave() {
+
+	mem_malloc_busy = 0;
+	pthread_mutex_unlock(&mem_malloc_lock);
+
+}
+
+// runs on the first call, under the lock, with mem_malloc_busy set, so the
+// allocations mem_init() and dlsym() make for themselves come from glibc
+static void _mem_malloc_init() {
+
+	mem_malloc_ready = (mem_init() == ALLOC_OK) ? 1 : -1;
+
+	libc_usable_size = (size_t (*)(void *)) dlsym(RTLD_NEXT, "malloc_usable_size");
+
+	// a child must not inherit the lock from a thread that doesn't exist over there
+	pthread_atfork(_mem_malloc_lock, _mem_malloc_unlock, _mem_malloc_unlock);
+
+}
+
+static void _mem_malloc_lock() {
+
+	pthread_mutex_lock(&mem_malloc_lock);
+
+}
+
+static void _mem_malloc_unlock() {
+
+	pthread_mutex_unlock(&mem_malloc_lock);
+
+}
+
+// note: called with the lock held
+static void *_mem_malloc_alloc(size_t size, int zeroed) {
+
+	// anything mem_pool can't hold goes to glibc, free() will know it's not ours
+	if (mem_malloc_ready < 0 || size > MEM_POOL_MAX_SIZE - MEM_MALLOC_ALIGNMENT)
+		return _mem_malloc_libc(size, zeroed);
+
+	// multiples of 16 all the way, so every allocation in a pool stays aligned
+	size = size ? (size + MEM_MALLOC_ALIGNMENT - 1) & ~(MEM_MALLOC_ALIGNMENT - 1) : MEM_MALLOC_ALIGNMENT;
+
+	alloc_pt alloc;
+
+	// big ones get a pool to themselves, closed again by free()
+	// note: these are the only FIRST_FIT pools, that's how free() tells them from the arenas
+	if (size >= MEM_MALLOC_LARGE_SIZE) {
+
+		pool_pt pool = mem_pool_open(size, FIRST_FIT);
+		if (!pool)
+			return _mem_malloc_libc(size, zeroed);
+
+		alloc = _mem_malloc_new(pool, size, zeroed);
+		if (!alloc) {
+			mem_pool_close(pool);
+			return _mem_malloc_libc(size, zeroed);
+		}
+
+		return alloc->mem;
+
+	}
+
+	// the current arena, then the others, and only then a new one
+	for (unsigned i = 0; i < num_arenas; i++) {
+		unsigned a = (cur_arena + i) % num_arenas;
+		if (arenas[a]->total_size - arenas[a]->alloc_size < size)
+			continue;
+		alloc = _mem_malloc_new(arenas[a], size, zeroed);
+		if (alloc) {
+			cur_arena = a;
+			return alloc->mem;
+		}
+	}
+
+	if (num_arenas == _MEM_MALLOC_MAX_ARENAS)
+		return _mem_malloc_libc(size, zeroed);
+
+	pool_pt pool = mem_pool_open(MEM_MALLOC_ARENA_SIZE, BEST_FIT);
+	if (!pool)
+		return _mem_malloc_libc(size, zeroed);
+
+	// small frees and mallocs of the same sizes mostly skip the merging and the gap index
+	// note: the arena works the same without them, so a failure is ignored
+	mem_pool_enable_quick_lists(pool);
+
+	arenas[num_arenas] = pool;
+	cur_arena = num_arenas++;
+
+	alloc = _mem_malloc_new(pool, size, zeroed);
+
+	return alloc ? alloc->mem : NULL;
+
+}
+
+static alloc_pt _mem_malloc_new(pool_pt pool, size_t size, int zeroed) {
+
+	return zeroed ? mem_new_alloc_zeroed(pool, size) : mem_new_alloc(pool, size);
+
+}
+
+static void *_mem_malloc_libc(size_t size, int zeroed) {
+
+	return zeroed ? __libc_calloc(1, size) : __libc_malloc(size);
+
+}
+
+// note: called with the lock held
+static void *_mem_malloc_aligned(size_t alignment, size_t size) {
+
+	if (alignment <= MEM_MALLOC_ALIGNMENT)
+		return _mem_malloc_alloc(size, 0);
+
+	if (mem_malloc_ready < 0 || size > MEM_POOL_MAX_SIZE - alignment)
+		return __libc_memalign(alignment, size);
+
+	// over-allocate, then step up to the boundary; any step is at least 16
+	// bytes, which is room for the header that leads free() back to the start
+	// note: never zero bytes, or the boundary could be the start of the next allocation
+	char *base = _mem_malloc_alloc((size ? size : 1) + alignment - MEM_MALLOC_ALIGNMENT, 0);
+	if (!base)
+		return NULL;
+
+	char *ptr = (char *)(((uintptr_t)base + alignment - 1) & ~(uintptr_t)(alignment - 1));
+
+	if (ptr != base) {
+		aligned_hdr_pt hdr = (aligned_hdr_pt)ptr - 1;
+		hdr->magic = MEM_MALLOC_ALIGNED_MAGIC;
+		hdr->base = base;
+	}
+
+	return ptr;
+
+}
+
+// the allocation ptr belongs to, and where it starts
+static alloc_pt _mem_malloc_find(pool_pt pool, void *ptr, char **base) {
+
+	alloc_pt alloc = mem_find_alloc(ptr);
+
+	if (alloc) {
+		*base = ptr;
+		return alloc;
+	}
+
+	// an aligned one, the header says where it starts
+	aligned_hdr_pt hdr = (aligned_hdr_pt)ptr - 1;
+	if ((char *)hdr < pool->mem || hdr->magic != MEM_MALLOC_ALIGNED_MAGIC)
+		return NULL;
+
+	*base = hdr->base;
+	return mem_find_alloc(hdr->base);
+
+}
+
+// note: called with the lock held
+static void _mem_malloc_release(pool_pt pool, void *ptr) {
+
+	char *base;
+	alloc_pt alloc = _mem_malloc_find(pool, ptr, &base);
+
+	// not the start of an allocation: a bad free(), ignore it
+	if (!alloc)
+		return;
+
+	if (base != ptr)
+		((aligned_hdr_pt)ptr - 1)->magic = 0;
+
+	mem_del_alloc(pool, alloc);
+
+	if (pool->policy == FIRST_FIT && pool->num_allocs == 0)
+		mem_pool_close(pool);
+
+}
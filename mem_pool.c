@@ -2,12 +2,29 @@
 * Created by Ivo Georgiev on 2/9/16.
 */
 
+#define _GNU_SOURCE // for memfd_create()
+
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <stdint.h>
 #include <stdio.h> // for perror()
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h> // for sqrt()
 
 #include "mem_pool.h"
 
+// the fit kernels use SSE2 (baseline on x86-64) and AVX2 (picked at runtime)
+#if defined(__x86_64__) && defined(__GNUC__)
+#define _MEM_X86_SIMD
+#include <immintrin.h>
+#endif
+
 //susing namespace std;
 
 /*************/
@@ -21,7 +38,26 @@
 #define _MEM_EXPAND_FACTOR                              2
 #define _MEM_POOL_STORE_INIT_CAPACITY					20
 #define _MEM_NODE_HEAP_INIT_CAPACITY					40
+#define _MEM_NODE_RESERVE_BYTES							64
 #define _MEM_GAP_IX_INIT_CAPACITY						40
+#define _MEM_GAP_IX_CHUNK								256
+#define _MEM_ADDR_IX_INIT_CAPACITY						64
+#define _MEM_TAG_INIT_CAPACITY							16
+#define _MEM_PAGE_MAP_SHIFT								12
+#define _MEM_PAGE_MAP_LEVEL_BITS						12
+#define _MEM_MAINT_FILL_FACTOR							0.5
+#define _MEM_MAINT_PERIOD_MS							100
+#define _MEM_MAINT_TRIM_MIN								(64 * 1024)
+#define _MEM_EVENT_RING_CAPACITY						256
+#define _MEM_COMPACT_NODES								4
+#define _MEM_COMPACT_ADDR_IX							8
+#define _MEM_ZERO_MADVISE_MIN							(256 * 1024)
+#define _MEM_ADAPT_WINDOW								256
+#define _MEM_ADAPT_LOG									16
+#define _MEM_QUICK_SLOTS								16
+#define _MEM_QUICK_MAX_SIZE								1024
+#define _MEM_QUICK_MAX_BLOCKS							256
+#define _MEM_ALIGN16(n)									(((n) + 15) & ~(size_t)15)
 
 static const float      MEM_FILL_FACTOR = _MEM_FILL_FACTOR;
 static const unsigned   MEM_EXPAND_FACTOR = _MEM_EXPAND_FACTOR;
@@ -34,10 +70,71 @@ static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY = _MEM_NODE_HEAP_INIT_CAPACI
 static const float      MEM_NODE_HEAP_FILL_FACTOR = _MEM_FILL_FACTOR;
 static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR = _MEM_EXPAND_FACTOR;
 
+// the node arrays are reserved for one node per this many bytes of pool at first, see _mem_move_nodes()
+static const size_t     MEM_NODE_RESERVE_BYTES = _MEM_NODE_RESERVE_BYTES;
+
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY = _MEM_GAP_IX_INIT_CAPACITY;
 static const float      MEM_GAP_IX_FILL_FACTOR = _MEM_FILL_FACTOR;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR = _MEM_EXPAND_FACTOR;
 
+// the gap index is kept in chunks of this many entries once it outgrows one, so an insert or a
+// remove moves at most a chunk's worth, however many gaps there are, see _mem_add_to_gap_ix()
+static const unsigned   MEM_GAP_IX_CHUNK = _MEM_GAP_IX_CHUNK;
+
+static const unsigned   MEM_ADDR_IX_INIT_CAPACITY = _MEM_ADDR_IX_INIT_CAPACITY; // power of 2
+static const float      MEM_ADDR_IX_FILL_FACTOR = _MEM_FILL_FACTOR;
+static const unsigned   MEM_ADDR_IX_EXPAND_FACTOR = _MEM_EXPAND_FACTOR;
+
+// per-tag stats are an array indexed by tag, grown to the biggest tag seen
+static const unsigned   MEM_TAG_INIT_CAPACITY = _MEM_TAG_INIT_CAPACITY;
+static const unsigned   MEM_TAG_EXPAND_FACTOR = _MEM_EXPAND_FACTOR;
+
+// the page map is a three-level radix tree over 4K pages, which covers 48-bit addresses
+// note: pool memory is mapped whole pages at a time, so a page belongs to one pool at most
+static const unsigned   MEM_PAGE_MAP_SHIFT = _MEM_PAGE_MAP_SHIFT;
+static const unsigned   MEM_PAGE_MAP_LEVEL_BITS = _MEM_PAGE_MAP_LEVEL_BITS;
+static const uintptr_t  MEM_PAGE_MAP_LEVEL_MASK = (1 << _MEM_PAGE_MAP_LEVEL_BITS) - 1;
+
+// the maintenance worker grows things at this fill factor, well before the callers would have to
+// note: it wakes up every period anyway, and trims only gaps of at least MEM_MAINT_TRIM_MIN
+static const float      MEM_MAINT_FILL_FACTOR = _MEM_MAINT_FILL_FACTOR;
+static const long       MEM_MAINT_PERIOD_MS = _MEM_MAINT_PERIOD_MS;
+static const size_t     MEM_MAINT_TRIM_MIN = _MEM_MAINT_TRIM_MIN;
+
+// mem_new_alloc_zeroed() hands whole pages of dirty runs at least this big back to the kernel instead of clearing them
+static const size_t     MEM_ZERO_MADVISE_MIN = _MEM_ZERO_MADVISE_MIN;
+
+// compact pools start out with this much metadata inside their block, see mem_pool_open_compact()
+static const unsigned   MEM_COMPACT_NODES = _MEM_COMPACT_NODES;
+static const unsigned   MEM_COMPACT_ADDR_IX = _MEM_COMPACT_ADDR_IX; // power of 2
+
+// ADAPTIVE pools decide once per window of allocations, on these thresholds, see _mem_adapt()
+// note: the way back to FIRST_FIT asks for much shorter scans and half the fragmentation, so it doesn't flap
+static const unsigned   MEM_ADAPT_WINDOW = _MEM_ADAPT_WINDOW;
+static const unsigned   MEM_ADAPT_LOG = _MEM_ADAPT_LOG; // switches kept per pool
+static const float      MEM_ADAPT_SCAN_MAX = 1024;      // nodes read per FIRST_FIT search
+static const float      MEM_ADAPT_FRAG_MAX = 0.5;
+static const float      MEM_ADAPT_SLIVER_MAX = 0.5;
+static const float      MEM_ADAPT_CV_MIXED = 0.5;
+static const float      MEM_ADAPT_CV_UNIFORM = 0.1;
+
+// quick lists take freed blocks up to MEM_QUICK_MAX_SIZE, one size per slot; once they hold
+// MEM_QUICK_MAX_BLOCKS, all of them are merged back into the gaps, see mem_pool_enable_quick_lists()
+static const unsigned   MEM_QUICK_SLOTS = _MEM_QUICK_SLOTS; // power of 2
+static const size_t     MEM_QUICK_MAX_SIZE = _MEM_QUICK_MAX_SIZE;
+static const unsigned   MEM_QUICK_MAX_BLOCKS = _MEM_QUICK_MAX_BLOCKS;
+
+// failures are kept in a fixed ring, the oldest are overwritten (power of 2)
+static const unsigned   MEM_EVENT_RING_CAPACITY = _MEM_EVENT_RING_CAPACITY;
+
+// node sizes: 0 is an unused node, the top bit marks an allocation, anything else is a gap
+// note: read as signed, gaps are exactly the positive entries, which is what the kernels test;
+// an allocation of size 0 is a block on a quick list, free but passed over like an allocation
+static const uint32_t   MEM_NIL = 0xFFFFFFFF;
+static const uint32_t   MEM_SEG_ALLOCATED = 0x80000000;
+static const uint32_t   MEM_SEG_SIZE_MASK = 0x7FFFFFFF;
+static const uint32_t   MEM_SEG_QUICK = 0x80000000;
+
 
 
 /*********************/
@@ -45,27 +142,147 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR = _MEM_EXPAND_FACTOR;
 /* Type declarations */
 /*                   */
 /*********************/
+// a segment is its entry in node_sizes and this, 20 bytes; only allocations have a record as well
+// note: aux depends on what the node is: an allocation's record, a gap's dirty bytes (the ones up
+// front that may not be zero, the rest is known zero), or the next block on a quick list (those are
+// all dirty); nothing but the size of an unused node is ever read
 typedef struct _node {
-	alloc_t alloc_record;
-	unsigned used;
-	unsigned allocated;
-	struct _node *next, *prev; // doubly-linked list for gap deletion
+	uint32_t next, prev; // doubly-linked list for gap deletion, MEM_NIL at the ends
+	uint32_t offset;     // where the segment starts, from pool.mem
+	uint32_t aux;
 } node_t, *node_pt;
 
-typedef struct _gap {
+// what's handed out as alloc_pt, one per live allocation
+// note: records are taken from the front of their array, so only as many are ever touched as
+// there were allocations live at once; a free one has NULL in alloc.mem
+typedef struct _alloc_rec {
+	alloc_t alloc;
+	uint32_t node;       // the allocation's node; on a free record, the next free one
+} alloc_rec_t, *alloc_rec_pt;
+
+// allocation order for mem_pool_release_to(), per node, only once the pool has a mark
+typedef struct _alloc_order {
+	uint32_t older, newer; // live allocations in allocation order, MEM_NIL at the ends
+	pool_mark_t seq;       // when it was allocated, marks are compared against it
+} alloc_order_t, *alloc_order_pt;
+
+// what the pool keeps per tag, tag_stats_t is built from it on demand
+typedef struct _tag_rec {
+	size_t live_bytes;
+	size_t peak_bytes;
+	unsigned live_count;
+	unsigned long allocs;
+	unsigned long allocs_at_dump; // allocs at the last mem_pool_dump_tags(), for the rate
+} tag_rec_t, *tag_rec_pt;
+
+// a mem_new_alloc_wait() caller, on its own stack for as long as it waits
+typedef struct _waiter {
 	size_t size;
-	node_pt node;
-} gap_t, *gap_pt;
+	pthread_cond_t wake;     // signaled only when a gap of size is there and it's first in line
+	struct _waiter *next, *prev;
+} waiter_t, *waiter_pt;
+
+// what a pool shared between threads needs, only those pools pay for it, see mem_pool_share()
+typedef struct _sync {
+	pthread_mutex_t lock;    // every call on the pool takes it
+	waiter_pt wait_head;     // waiters, served strictly oldest first
+	waiter_pt wait_tail;
+} sync_t, *sync_pt;
+
+// a maintenance worker, it shares the pool's lock
+typedef struct _maint {
+	pthread_t thread;
+	pthread_cond_t wake;
+	int stop;
+} maint_t, *maint_pt;
+
+// an ADAPTIVE pool's samples and switch log, only those pools pay for it
+typedef struct _adapt {
+	alloc_policy placement;  // FIRST_FIT or BEST_FIT
+	unsigned allocs;         // requests in the current window
+	double size_sum, size_sq_sum;
+	size_t min_size;
+	double scan_sum;         // nodes read by FIRST_FIT searches, or by the one sample under BEST_FIT
+	unsigned scans;
+	unsigned long windows;
+	unsigned long switches;
+	adapt_window_t last;
+	adapt_switch_t log[_MEM_ADAPT_LOG]; // a ring, the next switch goes at switches % MEM_ADAPT_LOG
+} adapt_t, *adapt_pt;
+
+// freed blocks kept back from merging, by exact size, only pools that turn them on pay for it
+typedef struct _quick {
+	uint32_t sizes[_MEM_QUICK_SLOTS]; // the one size each list holds, 0 while it's empty
+	uint32_t heads[_MEM_QUICK_SLOTS]; // newest block first, MEM_NIL if none
+	unsigned count;                   // blocks on all the lists
+} quick_t, *quick_pt;
+
+// a chunk of the gap index, see _mem_add_to_gap_ix()
+typedef struct _gap_chunk {
+	uint32_t chunk; // its entries start at chunk * gap_chunk_size in gap_sizes and gap_nodes
+	uint32_t len;
+} gap_chunk_t, *gap_chunk_pt;
+
+// a record array, see _mem_move_nodes() and _mem_resize_compact_nodes()
+typedef struct _rec_block {
+	struct _rec_block *prev; // the array this one replaced, kept for the alloc_pt's still pointing into it
+	size_t bytes;            // mapped, header included; 0 if it's from malloc() (compact pools)
+	alloc_rec_t recs[];
+} rec_block_t, *rec_block_pt;
 
 typedef struct _pool_mgr {
 	pool_t pool;
-	node_pt node_heap;
+	uint32_t *node_sizes;    // size and state of each node, the only array the searches read
+	node_pt node_heap;       // links, parallel to node_sizes
+	alloc_rec_pt alloc_recs; // as many as nodes, so there's always a free one; all three grow in place inside their reservations
+	unsigned recs_used;      // records ever taken, the ones past it have never been touched
+	uint32_t rec_free;       // free records below recs_used, MEM_NIL if none
+	size_t max_nodes;        // nodes the pool can ever need, one per byte of pool plus the top node
+	size_t reserved_nodes;   // nodes the reservations hold, past that they move to bigger ones
 	unsigned total_nodes;
 	unsigned used_nodes;
-	gap_pt gap_ix;
+	unsigned unused_hint;    // no unused node below this index
+	uint32_t *alloc_tags;    // per node, NULL until an allocation is tagged with anything but 0
+	alloc_order_pt alloc_order; // per node, NULL until the first mem_pool_mark()
+	pool_mark_t order_since; // alloc_seq when alloc_order started, older marks can't be released to
+	uint32_t newest_alloc;   // newest live allocation's node, MEM_NIL if none (or not tracked)
+	pool_mark_t alloc_seq;   // allocations ever made, the next allocation's seq
+	uint32_t *gap_sizes;     // gap index, sorted ascending by size then node, sizes and nodes kept apart
+	uint32_t *gap_nodes;
+	gap_chunk_pt gap_chunks; // the chunks of both in index order, the first gap_num_chunks in use, the rest empty
+	unsigned gap_num_chunks;
+	unsigned gap_chunk_size; // the whole capacity up to MEM_GAP_IX_CHUNK, one chunk
+	unsigned gap_ix_size;    // gaps in the index; pool.num_gaps counts runs of free nodes, quick blocks and all
 	unsigned gap_ix_capacity;
+	uint32_t *addr_ix;       // hash of allocation offsets to nodes, linear probing, MEM_NIL is empty
+	unsigned addr_ix_capacity;
+	unsigned addr_ix_shift;  // 32 - log2(capacity), for fibonacci hashing
+	unsigned store_slot;     // index in pool_store, for an O(1) close
+	int mem_fd;              // memfd that pool.mem is a view of, from open or the first clone, -1 before
+	int mem_shared;          // pool.mem is still a shared view of mem_fd, nothing has been cloned from it yet
+	sync_pt sync;            // NULL until the pool is shared, then until it's closed
+	maint_pt maint;          // the maintenance worker, NULL if there is none, see mem_pool_start_maintenance()
+	int maint_dirty;         // gaps were freed since the last trim
+	unsigned long maint_ops; // allocations and frees, so the worker can tell it's idle
+	tag_rec_pt tags;         // indexed by tag
+	unsigned tags_capacity;
+	double tags_since;       // when the current rate window started, see mem_pool_dump_tags()
+	adapt_pt adapt;          // NULL unless the policy is ADAPTIVE
+	quick_pt quick;          // NULL unless quick lists are on, see mem_pool_enable_quick_lists()
+	rec_block_pt rec_block;  // holds alloc_recs, and the arrays they outgrew; NULL while a compact pool's are in its block
+	int compact;             // from mem_pool_open_compact(), everything below is only for those
+	struct _pool_mgr *compact_prev, *compact_next; // open compact pools, for mem_free()
 } pool_mgr_t, *pool_mgr_pt;
 
+// a ring slot: state is 2 * seq + 1 while the event is written, 2 * seq + 2 once it's done
+typedef struct _mem_event_slot {
+	unsigned long state;
+	mem_event_t event;
+} mem_event_slot_t, *mem_event_slot_pt;
+
+// returns the index of the first gap >= size, or count if there is none
+typedef size_t (*_mem_fit_fn)(const uint32_t *sizes, size_t count, size_t size);
+
 
 
 /***************************/
@@ -76,6 +293,18 @@ typedef struct _pool_mgr {
 static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
 static unsigned pool_store_size = 0;
 static unsigned pool_store_capacity = 0;
+static unsigned *pool_store_free = NULL; // stack of emptied slots below pool_store_size
+static unsigned pool_store_num_free = 0;
+static pool_mgr_pt compact_pools = NULL; // not in the store, so the store never grows for them
+
+// page number -> owning pool, see _mem_page_map_set()
+static pool_mgr_pt **page_map[1 << _MEM_PAGE_MAP_LEVEL_BITS];
+
+// see _mem_fail(); initial-exec so the malloc shim never allocates to reach it
+static __thread mem_error mem_last_err __attribute__((tls_model("initial-exec"))) = MEM_ERR_NONE;
+static mem_event_slot_t mem_events[_MEM_EVENT_RING_CAPACITY];
+static unsigned long mem_events_head = 0; // events ever written
+static unsigned long mem_events_tail = 0; // events drained, or lost
 
 
 
@@ -87,18 +316,91 @@ static unsigned pool_store_capacity = 0;
 /*                                          */
 /********************************************/
 static alloc_status _mem_resize_pool_store();
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr, float fill_factor);
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr, float fill_factor);
 static alloc_status
 _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
 	size_t size,
-	node_pt node);
+	uint32_t node);
 static alloc_status
 _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
 	size_t size,
-	node_pt node);
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
-static node_pt _mem_find_unused_node(pool_mgr_pt pool_mgr);
+	uint32_t node);
+static int _mem_gap_ix_full(pool_mgr_pt pool_mgr, float fill_factor);
+static unsigned _mem_gap_ix_find(pool_mgr_pt pool_mgr, size_t size, uint32_t node, unsigned *i);
+static void _mem_gap_ix_drop_chunk(pool_mgr_pt pool_mgr, unsigned c);
+static unsigned _mem_gap_ix_rank(pool_mgr_pt pool_mgr, size_t size);
+static uint32_t _mem_gap_ix_largest(pool_mgr_pt pool_mgr);
+static uint32_t _mem_find_unused_node(pool_mgr_pt pool_mgr);
+static void _mem_release_node(pool_mgr_pt pool_mgr, uint32_t node);
+static uint32_t _mem_new_alloc_rec(pool_mgr_pt pool_mgr);
+static void _mem_drop_alloc_rec(pool_mgr_pt pool_mgr, alloc_rec_pt rec);
+static int _mem_released_by(pool_mgr_pt pool_mgr, uint32_t node, pool_mark_t mark);
+static alloc_status _mem_release_to(pool_mgr_pt pool_mgr, pool_mark_t mark);
+static alloc_rec_pt _mem_find_alloc_rec(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_status _mem_resize_addr_ix(pool_mgr_pt pool_mgr, float fill_factor);
+static void _mem_add_to_addr_ix(pool_mgr_pt pool_mgr, uint32_t node);
+static void _mem_remove_from_addr_ix(pool_mgr_pt pool_mgr, uint32_t node);
+static uint32_t _mem_addr_ix_find(pool_mgr_pt pool_mgr, const char *mem);
+static size_t _mem_pool_bytes(size_t size);
+static alloc_status _mem_page_map_set(const char *mem, size_t bytes, pool_mgr_pt pool_mgr);
+static void _mem_store_pool(pool_mgr_pt pool_mgr);
+static int _mem_in_block(pool_mgr_pt pool_mgr, const void *array);
+static void *_mem_realloc_array(pool_mgr_pt pool_mgr, void *array, size_t bytes, size_t new_bytes);
+static void _mem_free_array(pool_mgr_pt pool_mgr, void *array);
+static alloc_status _mem_resize_compact_nodes(pool_mgr_pt pool_mgr, size_t new_total);
+static alloc_status _mem_resize_node_extras(pool_mgr_pt pool_mgr, size_t new_total);
+static alloc_status _mem_move_nodes(pool_mgr_pt pool_mgr, size_t new_total);
+static size_t _mem_rec_block_bytes(size_t nodes);
+static void _mem_close_rec_blocks(pool_mgr_pt pool_mgr);
+static void _mem_close_compact(pool_mgr_pt pool_mgr);
+static alloc_status _mem_clone_pages(pool_mgr_pt pool_mgr, pool_mgr_pt clone);
+static alloc_status _mem_clone_metadata(pool_mgr_pt pool_mgr, pool_mgr_pt clone);
+static alloc_status _mem_make_base(pool_mgr_pt pool_mgr);
+static void _mem_copy_dirty_pages(pool_mgr_pt pool_mgr, char *dst);
+static void _mem_copy_dirty_run(int fd, const char *src, char *dst, size_t page, size_t first, size_t end);
+static pool_mgr_pt _mem_page_map_get(const void *ptr);
+static void *_mem_reserve(size_t bytes);
+static alloc_status _mem_commit(void *base, size_t bytes);
+static void _mem_unreserve(void *base, size_t bytes);
+static alloc_pt _mem_new_alloc(pool_mgr_pt pool_mgr, size_t size, unsigned tag, uint32_t *dirty);
+static uint32_t _mem_find_gap(pool_mgr_pt pool_mgr, alloc_policy placement, size_t size);
+static alloc_status _mem_resize_tags(pool_mgr_pt pool_mgr, unsigned tag);
+static void _mem_tag_stats(pool_mgr_pt pool_mgr, unsigned tag, double now, tag_stats_pt stats);
+static int _mem_tag_stats_cmp(const void *a, const void *b);
+static double _mem_now();
+static alloc_status _mem_del_alloc(pool_mgr_pt pool_mgr, alloc_rec_pt rec);
+static alloc_status _mem_merge_gap(pool_mgr_pt pool_mgr, uint32_t node_to_delete, uint32_t size);
+static void _mem_lock(pool_mgr_pt pool_mgr);
+static void _mem_unlock(pool_mgr_pt pool_mgr);
+static alloc_status _mem_share(pool_mgr_pt pool_mgr);
+static int _mem_fits(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_wake_waiter(pool_mgr_pt pool_mgr, size_t gap_size);
+static int _mem_maint_needed(pool_mgr_pt pool_mgr);
+static void *_mem_maint_worker(void *arg);
+static void _mem_maint_trim(pool_mgr_pt pool_mgr);
+static int _mem_zero_pages(pool_mgr_pt pool_mgr);
+static void _mem_zero(pool_mgr_pt pool_mgr, char *mem, size_t bytes);
+static void _mem_fail(mem_error error, const char *what, pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_start_adapt(pool_mgr_pt pool_mgr);
+static void _mem_adapt(pool_mgr_pt pool_mgr);
+static void _mem_adapt_reset(adapt_pt adapt);
+static quick_pt _mem_new_quick();
+static unsigned _mem_quick_slot(size_t size);
+static uint32_t _mem_quick_find(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_quick_pop(pool_mgr_pt pool_mgr, size_t size);
+static int _mem_quick_push(pool_mgr_pt pool_mgr, uint32_t node, uint32_t size);
+static alloc_status _mem_flush_quick(pool_mgr_pt pool_mgr);
+static unsigned _mem_free_neighbours(pool_mgr_pt pool_mgr, uint32_t node);
+static void _mem_select_fit_kernel();
+static size_t _mem_find_fit_scalar(const uint32_t *sizes, size_t count, size_t size);
+#ifdef _MEM_X86_SIMD
+static size_t _mem_find_fit_sse2(const uint32_t *sizes, size_t count, size_t size);
+static size_t _mem_find_fit_avx2(const uint32_t *sizes, size_t count, size_t size);
+#endif
+
+// FIRST_FIT search kernel, picked by _mem_select_fit_kernel() in mem_init()
+static _mem_fit_fn _mem_find_fit = _mem_find_fit_scalar;
 
 
 
@@ -115,22 +417,31 @@ alloc_status mem_init() {
 
 	if (pool_store)
 	{
-		puts("mem_init() called has already been called.  pool_store has already been initialized.\n");
+		_mem_fail(MEM_ERR_CALLED_AGAIN, "mem_init(): Already called, the pool store has already been initialized.", NULL, 0);
 		return ALLOC_NOT_FREED;
 	}
 
 	pool_store = malloc(sizeof(pool_mgr_pt[_MEM_POOL_STORE_INIT_CAPACITY]));
-	if (pool_store == NULL) {
-		puts("mem_init(): Could not allocate pool store.\n");
+	pool_store_free = malloc(sizeof(unsigned[_MEM_POOL_STORE_INIT_CAPACITY]));
+	if (pool_store == NULL || pool_store_free == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_init(): Could not allocate pool store.", NULL, 0);
+		free(pool_store);
+		free(pool_store_free);
+		pool_store = NULL;
+		pool_store_free = NULL;
 		return ALLOC_FAIL;
 	}
-	
+
 	pool_store_size = 0;
 	pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
+	pool_store_num_free = 0;
 
 	for (int i = 0; i < pool_store_capacity; i++)
 		pool_store[i] = NULL;
 
+	// pick the widest gap search the cpu supports
+	_mem_select_fit_kernel();
+
 
 	return ALLOC_OK;
 
@@ -146,15 +457,21 @@ alloc_status mem_free() {
 		return ALLOC_CALLED_AGAIN;
 
 
+	// close whatever pools the user left open
 	for (unsigned i = 0; i < pool_store_capacity; i++) {
 		if (pool_store[i])
-			free(pool_store[i]);
+			mem_pool_close((pool_pt) pool_store[i]);
 	}
+	while (compact_pools)
+		mem_pool_close((pool_pt) compact_pools);
 
 	free(pool_store);
+	free(pool_store_free);
 	pool_store = NULL;
+	pool_store_free = NULL;
 	pool_store_size = 0;
 	pool_store_capacity = 0;
+	pool_store_num_free = 0;
 
 
 	return ALLOC_OK;
@@ -167,9 +484,15 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
 	if (!pool_store)
 		return NULL;
 
+	// segment sizes and offsets are kept in 31 bits
+	if (!size || size > MEM_POOL_MAX_SIZE) {
+		_mem_fail(MEM_ERR_BAD_SIZE, "mem_pool_open(): Pool size must be between 1 and MEM_POOL_MAX_SIZE.", NULL, size);
+		return NULL;
+	}
+
 	// expand the pool store, if necessary
-	if ((float)pool_store_capacity / pool_store_size > MEM_FILL_FACTOR)
-		_mem_resize_pool_store();
+	if (_mem_resize_pool_store() == ALLOC_FAIL)
+		return NULL;
 
 
 	// allocate a new mem pool mgr
@@ -177,26 +500,51 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
 
 	// check success, on error return null
 	if (pool_mgr == NULL) {
-		puts("mem_pool_open(): Could not allocate pool manager.");
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open(): Could not allocate pool manager.", NULL, size);
 		return NULL;
 	}
 
 	//   initialize pool mgr
 	pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
 	pool_mgr->used_nodes = 1;
+	pool_mgr->unused_hint = 1;
+	pool_mgr->alloc_tags = NULL;
+	pool_mgr->alloc_order = NULL;
+	pool_mgr->order_since = 0;
+	pool_mgr->newest_alloc = MEM_NIL;
+	pool_mgr->alloc_seq = 0;
+	pool_mgr->gap_num_chunks = 1;
+	pool_mgr->gap_chunk_size = MEM_GAP_IX_INIT_CAPACITY;
+	pool_mgr->gap_ix_size = 1;
 	pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+	pool_mgr->addr_ix_capacity = MEM_ADDR_IX_INIT_CAPACITY;
+	pool_mgr->addr_ix_shift = 32 - __builtin_ctz(MEM_ADDR_IX_INIT_CAPACITY);
+	pool_mgr->store_slot = MEM_NIL;
+	pool_mgr->mem_fd = -1;
+	pool_mgr->mem_shared = 0;
+	pool_mgr->sync = NULL;
+	pool_mgr->maint = NULL;
+	pool_mgr->maint_dirty = 0;
+	pool_mgr->maint_ops = 0;
+	pool_mgr->adapt = NULL;
+	pool_mgr->quick = NULL;
+	pool_mgr->compact = 0;
+	pool_mgr->rec_block = NULL;
+	pool_mgr->compact_prev = NULL;
+	pool_mgr->compact_next = NULL;
 
 
 
 
 
 	// allocate a new memory pool
+	// note: whole pages straight from mmap(), so no two pools share a page in the page map
 	pool_t pool;
-	pool.mem = (char*) malloc(sizeof(char) * size);
+	pool.mem = mmap(NULL, _mem_pool_bytes(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
 	// check success, on error deallocate mgr and return null
-	if (pool.mem == NULL) {
-		puts("mem_pool_open(): Could not allocate pool.");
+	if (pool.mem == MAP_FAILED) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open(): Could not allocate pool.", NULL, size);
 		free(pool_mgr);
 		return NULL;
 	}
@@ -216,87 +564,140 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
 
 
 
-	// allocate a new node heap
-	node_pt node_heap = (node_pt) malloc(sizeof(node_t[_MEM_NODE_HEAP_INIT_CAPACITY]));
+	// reserve room for the node heap a pool of this size usually needs and commit the initial capacity
+	// note: reserving is only address space, pages are committed by the resize functions; a pool
+	// of smaller segments than that moves to bigger reservations, up to max_nodes
+	pool_mgr->max_nodes = size + 1;
+	if (pool_mgr->max_nodes < MEM_NODE_HEAP_INIT_CAPACITY)
+		pool_mgr->max_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+
+	pool_mgr->reserved_nodes = size / MEM_NODE_RESERVE_BYTES + 1;
+	if (pool_mgr->reserved_nodes < MEM_NODE_HEAP_INIT_CAPACITY)
+		pool_mgr->reserved_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+
+	uint32_t *node_sizes = _mem_reserve(sizeof(uint32_t) * pool_mgr->reserved_nodes);
+	node_pt node_heap = _mem_reserve(sizeof(node_t) * pool_mgr->reserved_nodes);
+	rec_block_pt rec_block = _mem_reserve(_mem_rec_block_bytes(pool_mgr->reserved_nodes));
 
 	// check success, on error deallocate mgr/pool and return null
-	if (!node_heap) {
-		puts("mem_pool_open(): Could not allocate node heap.");
-		free(pool_mgr->pool.mem);
+	if (!node_sizes || !node_heap || !rec_block
+		|| _mem_commit(node_sizes, sizeof(uint32_t[_MEM_NODE_HEAP_INIT_CAPACITY])) == ALLOC_FAIL
+		|| _mem_commit(node_heap, sizeof(node_t[_MEM_NODE_HEAP_INIT_CAPACITY])) == ALLOC_FAIL
+		|| _mem_commit(rec_block, _mem_rec_block_bytes(MEM_NODE_HEAP_INIT_CAPACITY)) == ALLOC_FAIL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open(): Could not allocate node heap.", NULL, size);
+		_mem_unreserve(node_sizes, sizeof(uint32_t) * pool_mgr->reserved_nodes);
+		_mem_unreserve(node_heap, sizeof(node_t) * pool_mgr->reserved_nodes);
+		_mem_unreserve(rec_block, _mem_rec_block_bytes(pool_mgr->reserved_nodes));
+		munmap(pool_mgr->pool.mem, _mem_pool_bytes(size));
 		free(pool_mgr);
 		return NULL;
 	}
 
+	rec_block->prev = NULL;
+	rec_block->bytes = _mem_rec_block_bytes(pool_mgr->reserved_nodes);
+	alloc_rec_pt alloc_recs = rec_block->recs;
+
 
 	// now to initialize each individual node
-	//   initialize top node of node heap	node_heap[0].used = 1;
-	node_heap[0].allocated = 0;
-	node_heap[0].alloc_record.size = size;
-	node_heap[0].alloc_record.mem = pool.mem;
-	node_heap[0].next = NULL;
-	node_heap[0].prev = NULL;
+	//   initialize top node of node heap
+	node_sizes[0] = (uint32_t)size;
+	node_heap[0].next = MEM_NIL;
+	node_heap[0].prev = MEM_NIL;
+	node_heap[0].offset = 0;
+	node_heap[0].aux = 0; // dirty bytes, none straight from mmap()
 
-	// populate the middle of the array
-	for (int i = 1; i < MEM_NODE_HEAP_INIT_CAPACITY; i++) {
-		node_heap[i].used = 0;
-		node_heap[i].allocated = 0;
-		node_heap[i].next = NULL;
-		node_heap[i].prev = NULL;
-	}
+	// the rest are fresh zero pages, which is already "unused" in node_sizes
+	// note: nothing else of an unused node is read, so its node's page isn't touched until it's used
 
 
 	// it has been created and populated, save the node heap
+	pool_mgr->node_sizes = node_sizes;
 	pool_mgr->node_heap = node_heap;
+	pool_mgr->alloc_recs = alloc_recs;
+	pool_mgr->recs_used = 0;
+	pool_mgr->rec_free = MEM_NIL;
+	pool_mgr->rec_block = rec_block;
 
 
 
 
 
-	// allocate a new gap index
-	gap_pt gap_ix = malloc(sizeof(node_t[_MEM_GAP_IX_INIT_CAPACITY]));
+	// allocate a new gap index, and the address index for mem_free_ptr()
+	uint32_t *gap_sizes = malloc(sizeof(uint32_t[_MEM_GAP_IX_INIT_CAPACITY]));
+	uint32_t *gap_nodes = malloc(sizeof(uint32_t[_MEM_GAP_IX_INIT_CAPACITY]));
+	gap_chunk_pt gap_chunks = malloc(sizeof(gap_chunk_t));
+	uint32_t *addr_ix = malloc(sizeof(uint32_t[_MEM_ADDR_IX_INIT_CAPACITY]));
+	tag_rec_pt tags = calloc(_MEM_TAG_INIT_CAPACITY, sizeof(tag_rec_t));
 
 	// check success, on error deallocate mgr/pool/heap and return null
-	if (!gap_ix) {
-		puts("Could not allocate gap index.");
-		free(pool_mgr->pool.mem);
-		free(pool_mgr->node_heap);
+	if (!gap_sizes || !gap_nodes || !gap_chunks || !addr_ix || !tags) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open(): Could not allocate gap index.", NULL, size);
+		free(gap_sizes);
+		free(gap_nodes);
+		free(gap_chunks);
+		free(addr_ix);
+		free(tags);
+		munmap(pool_mgr->pool.mem, _mem_pool_bytes(size));
+		_mem_unreserve(pool_mgr->node_sizes, sizeof(uint32_t) * pool_mgr->reserved_nodes);
+		_mem_unreserve(pool_mgr->node_heap, sizeof(node_t) * pool_mgr->reserved_nodes);
+		_mem_close_rec_blocks(pool_mgr);
 		free(pool_mgr);
 		return NULL;
 	}
 
 	//   initialize top node of gap index
-	gap_ix[0].size = size;
-	gap_ix[0].node = pool_mgr->node_heap;
+	gap_sizes[0] = (uint32_t)size;
+	gap_nodes[0] = 0;
 
 	// initialize the rest as no gaps
 	for (int i = 1; i < MEM_GAP_IX_INIT_CAPACITY; i++) {
-		gap_ix[i].size = 0;
-		gap_ix[i].node = NULL;
+		gap_sizes[i] = 0;
+		gap_nodes[i] = MEM_NIL;
 	}
 
+	// it all fits in one chunk for now
+	gap_chunks[0].chunk = 0;
+	gap_chunks[0].len = 1;
+
 	// it's ready to be saved to the pool manager
-	pool_mgr->gap_ix = gap_ix;
+	pool_mgr->gap_sizes = gap_sizes;
+	pool_mgr->gap_nodes = gap_nodes;
+	pool_mgr->gap_chunks = gap_chunks;
+
+	// no allocations yet
+	for (int i = 0; i < MEM_ADDR_IX_INIT_CAPACITY; i++)
+		addr_ix[i] = MEM_NIL;
+	pool_mgr->addr_ix = addr_ix;
+
+	// no tags yet either
+	pool_mgr->tags = tags;
+	pool_mgr->tags_capacity = MEM_TAG_INIT_CAPACITY;
+	pool_mgr->tags_since = _mem_now();
+
+	// ADAPTIVE keeps its samples on the side
+	if (policy == ADAPTIVE && _mem_start_adapt(pool_mgr) == ALLOC_FAIL) {
+		mem_pool_close((pool_pt) pool_mgr);
+		return NULL;
+	}
 
 
 
 
 
 
-	// save to pool store
-	// search for empty spot in pool store
-	int x;
-	for (x = 0; x < pool_store_size; x++) {
-		if (pool_store[x] == NULL)
-			break;  // all we have to do is break to preserve the value of x
+	// let the page map know the pool's pages are ours
+	if (_mem_page_map_set(pool_mgr->pool.mem, _mem_pool_bytes(size), pool_mgr) == ALLOC_FAIL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open(): Could not add pool to page map.", NULL, size);
+		mem_pool_close((pool_pt) pool_mgr);
+		return NULL;
 	}
 
-	// x will either be the index of an empty spot or one past the last to expand
-	pool_store[x] = pool_mgr;
 
-	// if it did not find an empty spot, it was tacked on to the end
-	// we must increase the size
-	if (x == pool_store_size)
-		pool_store_size++;
+
+
+
+	// save to pool store
+	_mem_store_pool(pool_mgr);
 
 
 
@@ -305,6 +706,133 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
 
 }
 
+// a pool whose memory is a shared view of a memfd from the start, so cloning it never copies the memory
+// note: the first clone only turns the pool's view private, every page is already in the file; later
+// clones copy the pages under allocations the pool wrote to since the one before, see _mem_clone_pages()
+pool_pt mem_pool_open_cow(size_t size, alloc_policy policy) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)mem_pool_open(size, policy);
+	if (pool_mgr == NULL)
+		return NULL;
+
+	size_t bytes = _mem_pool_bytes(size);
+
+	// the file starts out as holes, which read as zero just like the fresh mmap() it replaces
+	int fd = memfd_create("mem_pool", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, (off_t)bytes)
+		|| mmap(pool_mgr->pool.mem, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open_cow(): Could not map pool to a memfd.", NULL, size);
+		if (fd >= 0)
+			close(fd);
+		mem_pool_close((pool_pt) pool_mgr);
+		return NULL;
+	}
+
+	pool_mgr->mem_fd = fd;
+	pool_mgr->mem_shared = 1;
+
+	return (pool_pt) pool_mgr;
+
+}
+
+// the mgr, small first arrays and the memory are one malloc(), so open and close are a malloc() and a free()
+// note: the arrays move out of the block as they grow; the pool is not in the page map, so
+// mem_pool_owner(), mem_find_alloc() and mem_free_ptr() don't see it, and it can't be cloned
+pool_pt mem_pool_open_compact(size_t size, alloc_policy policy) {
+
+	if (!pool_store)
+		return NULL;
+
+	if (!size || size > MEM_POOL_MAX_SIZE) {
+		_mem_fail(MEM_ERR_BAD_SIZE, "mem_pool_open_compact(): Pool size must be between 1 and MEM_POOL_MAX_SIZE.", NULL, size);
+		return NULL;
+	}
+
+	// the layout of the block, every part 16-byte aligned
+	size_t at_sizes = _MEM_ALIGN16(sizeof(pool_mgr_t));
+	size_t at_heap = at_sizes + _MEM_ALIGN16(sizeof(uint32_t[_MEM_COMPACT_NODES]));
+	size_t at_recs = at_heap + _MEM_ALIGN16(sizeof(node_t[_MEM_COMPACT_NODES]));
+	size_t at_gap_sizes = at_recs + _MEM_ALIGN16(sizeof(alloc_rec_t[_MEM_COMPACT_NODES]));
+	size_t at_gap_nodes = at_gap_sizes + _MEM_ALIGN16(sizeof(uint32_t[_MEM_COMPACT_NODES]));
+	size_t at_gap_chunks = at_gap_nodes + _MEM_ALIGN16(sizeof(uint32_t[_MEM_COMPACT_NODES]));
+	size_t at_addr_ix = at_gap_chunks + _MEM_ALIGN16(sizeof(gap_chunk_t));
+	size_t at_tags = at_addr_ix + _MEM_ALIGN16(sizeof(uint32_t[_MEM_COMPACT_ADDR_IX]));
+	size_t at_mem = at_tags + _MEM_ALIGN16(sizeof(tag_rec_t));
+
+	char *block = malloc(at_mem + size);
+
+	if (block == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open_compact(): Could not allocate pool.", NULL, size);
+		return NULL;
+	}
+
+	// zero is an unused node, an empty tag, and no state for everything else
+	memset(block, 0, at_mem);
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)block;
+
+	pool_mgr->pool.mem = block + at_mem;
+	pool_mgr->pool.policy = policy;
+	pool_mgr->pool.total_size = size;
+	pool_mgr->pool.num_gaps = 1;
+
+	pool_mgr->node_sizes = (uint32_t *)(block + at_sizes);
+	pool_mgr->node_heap = (node_pt)(block + at_heap);
+	pool_mgr->alloc_recs = (alloc_rec_pt)(block + at_recs);
+	pool_mgr->rec_free = MEM_NIL;
+	pool_mgr->max_nodes = size + 1;
+	pool_mgr->reserved_nodes = pool_mgr->max_nodes; // nothing to outgrow, the arrays are copied out
+	pool_mgr->total_nodes = MEM_COMPACT_NODES;
+	pool_mgr->used_nodes = 1;
+	pool_mgr->unused_hint = 1;
+	pool_mgr->newest_alloc = MEM_NIL;
+	pool_mgr->gap_sizes = (uint32_t *)(block + at_gap_sizes);
+	pool_mgr->gap_nodes = (uint32_t *)(block + at_gap_nodes);
+	pool_mgr->gap_chunks = (gap_chunk_pt)(block + at_gap_chunks);
+	pool_mgr->gap_num_chunks = 1;
+	pool_mgr->gap_chunk_size = MEM_COMPACT_NODES;
+	pool_mgr->gap_ix_size = 1;
+	pool_mgr->gap_ix_capacity = MEM_COMPACT_NODES;
+	pool_mgr->addr_ix = (uint32_t *)(block + at_addr_ix);
+	pool_mgr->addr_ix_capacity = MEM_COMPACT_ADDR_IX;
+	pool_mgr->addr_ix_shift = 32 - __builtin_ctz(MEM_COMPACT_ADDR_IX);
+	pool_mgr->store_slot = MEM_NIL;
+	pool_mgr->mem_fd = -1;
+	pool_mgr->mem_shared = 0;
+	pool_mgr->tags = (tag_rec_pt)(block + at_tags);
+	pool_mgr->tags_capacity = 1;
+	pool_mgr->tags_since = _mem_now();
+	pool_mgr->compact = 1;
+
+	// one gap, the whole pool, and it's from malloc() so nothing is known to be zero
+	pool_mgr->node_sizes[0] = (uint32_t)size;
+	pool_mgr->node_heap[0].next = MEM_NIL;
+	pool_mgr->node_heap[0].prev = MEM_NIL;
+	pool_mgr->node_heap[0].aux = (uint32_t)size;
+	for (unsigned i = 0; i < MEM_COMPACT_NODES; i++)
+		pool_mgr->gap_nodes[i] = MEM_NIL;
+	pool_mgr->gap_sizes[0] = (uint32_t)size;
+	pool_mgr->gap_nodes[0] = 0;
+	pool_mgr->gap_chunks[0].len = 1;
+
+	for (unsigned i = 0; i < MEM_COMPACT_ADDR_IX; i++)
+		pool_mgr->addr_ix[i] = MEM_NIL;
+
+	// on the list for mem_free()
+	pool_mgr->compact_next = compact_pools;
+	if (compact_pools)
+		compact_pools->compact_prev = pool_mgr;
+	compact_pools = pool_mgr;
+
+	if (policy == ADAPTIVE && _mem_start_adapt(pool_mgr) == ALLOC_FAIL) {
+		mem_pool_close((pool_pt) pool_mgr);
+		return NULL;
+	}
+
+	return (pool_pt) pool_mgr;
+
+}
+
 alloc_status mem_pool_close(pool_pt pool) {
 	// get mgr from pool by casting the pointer to (pool_mgr_pt)
 	// check if this pool is allocated
@@ -319,6 +847,23 @@ alloc_status mem_pool_close(pool_pt pool) {
 
 	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
+	// the worker goes first, it touches everything below
+	// note: nobody may be waiting on the pool by now, they'd be on a lock that's about to go
+	if (pool_mgr->maint)
+		mem_pool_stop_maintenance(pool);
+
+	if (pool_mgr->sync) {
+		pthread_mutex_destroy(&pool_mgr->sync->lock);
+		free(pool_mgr->sync);
+		pool_mgr->sync = NULL;
+	}
+
+	// one block, and whatever outgrew it
+	if (pool_mgr->compact) {
+		_mem_close_compact(pool_mgr);
+		return ALLOC_OK;
+	}
+
 
 	if (pool->total_size <= 0) {
 		// the pool's mem has not been initialized?
@@ -336,21 +881,32 @@ alloc_status mem_pool_close(pool_pt pool) {
 
 
 	// free dynamic memory
-	if (pool->mem)
-		free(pool->mem);
-	if (pool_mgr->node_heap)
-		free(pool_mgr->node_heap);
-	if (pool_mgr->gap_ix)
-		free(pool_mgr->gap_ix);
-
-
-
-	// remove pool_mgr from pool_store
-	for (int i = 0; i < pool_store_size; i++) {
-		if (pool_store[i] == pool_mgr) {
-			pool_store[i] = NULL;
-			break;
-		}
+	// note: a clone that failed half way may not have its memory yet
+	if (pool->mem) {
+		_mem_page_map_set(pool->mem, _mem_pool_bytes(pool->total_size), NULL);
+		munmap(pool->mem, _mem_pool_bytes(pool->total_size));
+	}
+	if (pool_mgr->mem_fd >= 0)
+		close(pool_mgr->mem_fd);
+	_mem_unreserve(pool_mgr->node_sizes, sizeof(uint32_t) * pool_mgr->reserved_nodes);
+	_mem_unreserve(pool_mgr->node_heap, sizeof(node_t) * pool_mgr->reserved_nodes);
+	_mem_close_rec_blocks(pool_mgr);
+	free(pool_mgr->gap_sizes);
+	free(pool_mgr->gap_nodes);
+	free(pool_mgr->gap_chunks);
+	free(pool_mgr->addr_ix);
+	free(pool_mgr->tags);
+	free(pool_mgr->alloc_tags);
+	free(pool_mgr->alloc_order);
+	free(pool_mgr->adapt);
+	free(pool_mgr->quick);
+
+
+
+	// remove pool_mgr from pool_store, the slot goes on the free stack
+	if (pool_mgr->store_slot != MEM_NIL) {
+		pool_store[pool_mgr->store_slot] = NULL;
+		pool_store_free[pool_store_num_free++] = pool_mgr->store_slot;
 	}
 
 	// free dynamic memory
@@ -363,547 +919,2862 @@ alloc_status mem_pool_close(pool_pt pool) {
 
 alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
 
-
-	// size sanity check
-	if (size > pool->total_size) {
-		puts("mem_new_alloc(): Requested size is greater than the total pool size.");
-		return NULL;
-	}
-
-
 	// get mgr from pool by casting the pointer to (pool_mgr_pt)
 	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
+	_mem_lock(pool_mgr);
+	alloc_pt alloc = _mem_new_alloc(pool_mgr, size, 0, NULL);
+	_mem_unlock(pool_mgr);
 
-	// check if any gaps, return null if none
-	if (!pool->num_gaps) {
-		puts("mem_new_alloc(): No gaps available.");
-		return NULL;
-	}
+	return alloc;
 
+}
 
-	// expand heap node, if necessary, quit on error
-	if (_mem_resize_node_heap(pool_mgr) == ALLOC_FAIL) {
-		puts("mem_new_alloc(): Could not resize heap pool.");
-		return NULL;
-	}
 
+alloc_pt mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag) {
 
-	// check used nodes fewer than total nodes, quit on error
-	if (pool_mgr->used_nodes > pool_mgr->total_nodes)
-	{
-		puts("mem_new_alloc(): Unknown error: number of used nodes exceeds the total nodes.");
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+	if (tag > MEM_POOL_MAX_TAG) {
+		_mem_fail(MEM_ERR_BAD_TAG, "mem_new_alloc_tagged(): Tag is greater than MEM_POOL_MAX_TAG.", pool_mgr, size);
 		return NULL;
 	}
 
+	_mem_lock(pool_mgr);
+	alloc_pt alloc = _mem_new_alloc(pool_mgr, size, tag, NULL);
+	_mem_unlock(pool_mgr);
 
+	return alloc;
 
+}
 
-	// get a node for allocation:
-	// if FIRST_FIT, then find the first sufficient node in the node heap
-	// if BEST_FIT, then find the first sufficient node in the gap index
-	node_pt node = NULL;
 
-	if (pool->policy == FIRST_FIT) {
+// calloc() for pools: only the part of the block that may have been written before is cleared
+alloc_pt mem_new_alloc_zeroed(pool_pt pool, size_t size) {
 
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
-		// loop through node heap
-		for (int i = 0; i < pool_mgr->total_nodes; i++) {
+	_mem_lock(pool_mgr);
 
-			node_pt n = &(pool_mgr->node_heap[i]);
+	uint32_t dirty = 0;
+	alloc_pt alloc = _mem_new_alloc(pool_mgr, size, 0, &dirty);
 
-			// we found a gap!
-			if (n->used && (!n->allocated)) {
-				// is it big enough?
-				if (n->alloc_record.size >= size) {
-					node = n;
-					break;
-				}
-			}
+	_mem_unlock(pool_mgr);
 
-		}
+	// the block is the caller's now, clear it outside the lock
+	if (dirty)
+		_mem_zero(pool_mgr, alloc->mem, dirty);
 
+	return alloc;
 
-	}
-	else if (pool->policy == BEST_FIT) {
+}
 
 
-		for (int i = 0; i < pool->num_gaps; i++) {
+// sleeps until the allocation fits, or the timeout runs out; waiters are served in the order they came
+// note: timeout_ms < 0 waits for good, 0 doesn't wait at all; a waiter that's first in line holds up
+// the ones behind it until a gap for it comes about, even if theirs would fit already
+alloc_pt mem_new_alloc_wait(pool_pt pool, size_t size, long timeout_ms) {
 
-			gap_t gap = pool_mgr->gap_ix[i];
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+	sync_pt sync = pool_mgr->sync;
 
-			// we found a gap! is it big enough?
-			if (gap.size >= size) {
-				node = gap.node;
-				break;
-			}
+	// nothing else could free anything while this one sleeps
+	if (!sync) {
+		_mem_fail(MEM_ERR_UNSUPPORTED, "mem_new_alloc_wait(): Pool is not shared, see mem_pool_share().", pool_mgr, size);
+		return NULL;
+	}
 
-		}
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	if (timeout_ms > 0) {
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+	}
 
+	_mem_lock(pool_mgr);
 
+	// no line, or no waiting, or a size that could never fit: straight to the allocation
+	// note: with a line, even a request that fits goes to the back of it
+	if ((!sync->wait_head && (_mem_fits(pool_mgr, size) || !timeout_ms)) || !size || size > pool->total_size) {
+		alloc_pt alloc = _mem_new_alloc(pool_mgr, size, 0, NULL);
+		_mem_unlock(pool_mgr);
+		return alloc;
 	}
-	else {
 
-		puts("mem_new_alloc(): Unknown allocation policy.");
+	if (!timeout_ms) {
+		_mem_fail(MEM_ERR_TIMEOUT, "mem_new_alloc_wait(): Other waiters are ahead in line.", pool_mgr, size);
+		_mem_unlock(pool_mgr);
 		return NULL;
-
 	}
 
+	// waiters only see merged gaps, and frees skip the quick lists while there are any
+	if (_mem_flush_quick(pool_mgr) == ALLOC_FAIL) {
+		_mem_unlock(pool_mgr);
+		return NULL;
+	}
 
+	// get in line
+	waiter_t waiter;
+	waiter.size = size;
+	waiter.next = NULL;
+	waiter.prev = sync->wait_tail;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	int error = pthread_cond_init(&waiter.wake, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (error) {
+		_mem_fail(MEM_ERR_SYSTEM, "mem_new_alloc_wait(): Could not create condition variable.", pool_mgr, size);
+		_mem_unlock(pool_mgr);
+		return NULL;
+	}
 
+	if (sync->wait_tail)
+		sync->wait_tail->next = &waiter;
+	else
+		sync->wait_head = &waiter;
+	sync->wait_tail = &waiter;
 
-
-	// check if node found
-	if (!node) {
-		puts("mem_new_alloc(): Could not find a suitable node.");
-		return NULL;
+	// wake-ups can be spurious, or the gap can be gone again by the time this one runs, so check every time
+	while (!(sync->wait_head == &waiter && _mem_fits(pool_mgr, size)) && error != ETIMEDOUT) {
+		if (timeout_ms < 0)
+			error = pthread_cond_wait(&waiter.wake, &sync->lock);
+		else
+			error = pthread_cond_timedwait(&waiter.wake, &sync->lock, &deadline);
 	}
-	
 
+	alloc_pt alloc = NULL;
+	if (sync->wait_head == &waiter && _mem_fits(pool_mgr, size))
+		alloc = _mem_new_alloc(pool_mgr, size, 0, NULL);
+	else
+		_mem_fail(MEM_ERR_TIMEOUT, "mem_new_alloc_wait(): Timed out waiting for a gap.", pool_mgr, size);
 
+	// out of line, and the next one may fit in what's left
+	if (waiter.prev)
+		waiter.prev->next = waiter.next;
+	else
+		sync->wait_head = waiter.next;
+	if (waiter.next)
+		waiter.next->prev = waiter.prev;
+	else
+		sync->wait_tail = waiter.prev;
 
-	// Handle the remaining gap
-	size_t new_gap = node->alloc_record.size - size;
+	if (sync->wait_head && _mem_fits(pool_mgr, sync->wait_head->size))
+		pthread_cond_signal(&sync->wait_head->wake);
 
+	_mem_unlock(pool_mgr);
 
-	// adjust node heap:
-	//   if remaining gap, need a new node
-	if (new_gap) {
+	pthread_cond_destroy(&waiter.wake);
 
-		//   find an unused one in the node heap
-		node_pt new_node = _mem_find_unused_node(pool_mgr);
+	return alloc;
 
-		//   make sure one was found
-		if (!new_node) {
-			puts("mem_new_alloc(): Could not find unused node.");
-			return NULL;
-		}
+}
 
 
-		//   initialize it to a gap node
-		new_node->allocated = 0;
-		new_node->used = 1;
-		new_node->alloc_record.mem = node->alloc_record.mem + size;
-		new_node->alloc_record.size = new_gap;
-		new_node->next = node->next;
-		new_node->prev = node;
+alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
 
-		//   update linked list (new node right after the node for allocation)
-		if (node->next)
-			node->next->prev = new_node;
-		node->next = new_node;
-		
+	// get mgr from pool by casting the pointer to (pool_mgr_pt)
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
-		//   update metadata (used_nodes)
-		pool_mgr->used_nodes++;
+	_mem_lock(pool_mgr);
 
-	}
-	
+	// get the record, and the node from the record
+	alloc_rec_pt rec = _mem_find_alloc_rec(pool_mgr, alloc);
 
+	// make sure it's found
+	alloc_status status = ALLOC_FAIL;
+	if (rec)
+		status = _mem_del_alloc(pool_mgr, rec);
+	else
+		_mem_fail(MEM_ERR_NOT_FOUND, "mem_del_alloc(): Could not find node to delete allocation.", pool_mgr, 0);
 
+	_mem_unlock(pool_mgr);
 
+	return status;
 
+}
 
-	// update gap list
-	if (_mem_remove_from_gap_ix(pool_mgr, size, node) == ALLOC_FAIL) {
-		puts("mem_new_alloc(): Could not update gap list.");
-		return NULL;
-	}
 
+void mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments) {
 
+	// get the mgr from the pool
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
+	_mem_lock(pool_mgr);
 
+	// quick blocks are shown as the gaps they're part of
+	if (_mem_flush_quick(pool_mgr) == ALLOC_FAIL) {
+		_mem_unlock(pool_mgr);
+		return;
+	}
 
-	// update metadata (num_allocs, alloc_size)
-	node->used = 1;
-	node->allocated = 1;
-	node->alloc_record.size = size;
+	// allocate the segments array with size == used_nodes
+	pool_segment_pt segs = (pool_segment_t*)malloc(sizeof(pool_segment_t) * pool_mgr->used_nodes);
 
-	pool->num_allocs++;
-	pool->alloc_size += size;
+	// check successful
+	if (segs == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_inspect_pool(): Could not inspect pool.  malloc() failed.", pool_mgr, 0);
+		_mem_unlock(pool_mgr);
+		return;
+	}
 
+	// walk the linked list from the top node (always node 0)
+	//    for each node, write the size and allocated in the segment
+	unsigned i = 0;
+	for (uint32_t n = 0; n != MEM_NIL && i < pool_mgr->used_nodes; n = pool_mgr->node_heap[n].next, i++) {
+		segs[i].allocated = (pool_mgr->node_sizes[n] & MEM_SEG_ALLOCATED) ? 1 : 0;
+		segs[i].size = pool_mgr->node_sizes[n] & MEM_SEG_SIZE_MASK;
+	}
 
+	_mem_unlock(pool_mgr);
 
-	
 
-	// return allocation record by casting the node to (alloc_pt)
-	return (alloc_pt) node;
+	// "return" the values:
+	*segments = segs;
+	*num_segments = i;
 
 }
 
 
-alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
-
-	// get mgr from pool by casting the pointer to (pool_mgr_pt)
-	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
-	// get node from alloc by casting the pointer to (node_pt)
-	node_pt node = (node_pt)pool;
+pool_pt mem_pool_owner(const void *ptr) {
 
-	node_pt node_to_delete = NULL;
+	// the page map gives the candidate, the tail of its last page is not the pool's
+	pool_mgr_pt pool_mgr = _mem_page_map_get(ptr);
 
+	if (!pool_mgr || (const char *)ptr >= pool_mgr->pool.mem + pool_mgr->pool.total_size)
+		return NULL;
 
+	return (pool_pt) pool_mgr;
 
-	// find the node in the node heap
-	for (int i = 0; i < pool_mgr->total_nodes; i++) {
-		if (pool_mgr->node_heap[i].alloc_record.mem == alloc->mem) {
-			node_to_delete = &(pool_mgr->node_heap[i]);
-			break;
-		}
-	}
+}
 
-	// this is node-to-delete
-	// make sure it's found
-	if (!node_to_delete) {
-		puts("mem_del_alloc(): Could not find node to delete allocation.");
-		return ALLOC_FAIL;
-	}
 
-	// convert to gap node
-	node_to_delete->allocated = 0;
-	node_to_delete->used = 1;
+alloc_pt mem_find_alloc(const void *ptr) {
 
-	// update metadata (num_allocs, alloc_size)
-	pool->num_allocs--;
-	pool->alloc_size -= alloc->size;
+	pool_mgr_pt pool_mgr = (pool_mgr_pt) mem_pool_owner(ptr);
 
+	if (!pool_mgr)
+		return NULL;
 
+	_mem_lock(pool_mgr);
+	uint32_t node = _mem_addr_ix_find(pool_mgr, ptr);
+	alloc_pt alloc = node == MEM_NIL ? NULL : &pool_mgr->alloc_recs[pool_mgr->node_heap[node].aux].alloc;
+	_mem_unlock(pool_mgr);
 
-	// if the next node in the list is also a gap, merge into node-to-delete
-	/*
-	if (next->next) {
-	next->next->prev = node_to_del;
-	node_to_del->next = next->next;
-	} else {
-	node_to_del->next = NULL;
-	}
-	next->next = NULL;
-	next->prev = NULL;
-	*/
-	node_pt next_node = node_to_delete->next;
-	if (next_node) {
-		// next_node is also a gap
-		if (next_node->used && !(next_node->allocated)) {
+	return alloc;
 
-			//   remove the next node from gap index
-			if (_mem_remove_from_gap_ix(pool_mgr, next_node->alloc_record.size, next_node) == ALLOC_FAIL) {
-				puts("Could not remove next node from gap index.");
-				return ALLOC_FAIL;
-			}
-			
-			//   add the size to the node-to-delete
-			node_to_delete->alloc_record.size += next_node->alloc_record.size;
-			//   update linked list:
-			node_to_delete->next = next_node->next;
-			if (node_to_delete->next)
-				node_to_delete->next->prev = node_to_delete;
+}
 
 
-			next_node->alloc_record.mem = NULL;
-			next_node->alloc_record.size = 0;
-			next_node->allocated = 0;
-			//   update node as unused
-			next_node->used = 0;
-			next_node->next = NULL;
-			next_node->prev = NULL;
+alloc_status mem_free_ptr(void *ptr) {
 
-			//   update metadata (used nodes)
-			pool_mgr->used_nodes--;
+	pool_mgr_pt pool_mgr = (pool_mgr_pt) mem_pool_owner(ptr);
 
-		}
+	if (!pool_mgr) {
+		_mem_fail(MEM_ERR_NOT_FOUND, "mem_free_ptr(): Pointer is not in any pool.", NULL, 0);
+		return ALLOC_FAIL;
 	}
 
+	_mem_lock(pool_mgr);
 
+	uint32_t node = _mem_addr_ix_find(pool_mgr, ptr);
 
-	// this merged node-to-delete might need to be added to the gap index
-	// but one more thing to check...
-	// if the previous node in the list is also a gap, merge into previous!
-	node_pt prev_node = node_to_delete->prev;
-	if (prev_node) {
-		if (prev_node->used && !(prev_node->allocated)) {
+	alloc_status status = ALLOC_FAIL;
+	if (node != MEM_NIL)
+		status = _mem_del_alloc(pool_mgr, &pool_mgr->alloc_recs[pool_mgr->node_heap[node].aux]);
+	else
+		_mem_fail(MEM_ERR_NOT_FOUND, "mem_free_ptr(): Pointer is not the start of an allocation.", pool_mgr, 0);
 
-			//   remove the previous node from gap index
-			if (_mem_remove_from_gap_ix(pool_mgr, prev_node->alloc_record.size, prev_node) == ALLOC_FAIL) {
-				puts("Could not remove previous node from gap index.");
-				return ALLOC_FAIL;
-			}
+	_mem_unlock(pool_mgr);
 
-			//   add the size of node-to-delete to the previous
-			prev_node->alloc_record.size += node_to_delete->alloc_record.size;
-			prev_node->next = node_to_delete->next;
+	return status;
+
+}
 
 
-			node_to_delete = prev_node;
+// every call on the pool takes a lock from here on, so threads can share it; mem_new_alloc_wait() needs this
+// note: call it before any other thread has the pool, it stays shared until it's closed
+alloc_status mem_pool_share(pool_pt pool) {
 
-			//   update metadata (used nodes)
-			pool_mgr->used_nodes--;
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
-		}
+	if (pool_mgr->sync) {
+		_mem_fail(MEM_ERR_CALLED_AGAIN, "mem_pool_share(): Pool is already shared.", pool_mgr, 0);
+		return ALLOC_CALLED_AGAIN;
 	}
 
+	return _mem_share(pool_mgr);
 
+}
 
-	_mem_add_to_gap_ix(pool_mgr, node_to_delete->alloc_record.size, node_to_delete);
 
-	return ALLOC_OK;
+alloc_status mem_pool_start_maintenance(pool_pt pool) {
 
-}
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
+	if (pool_mgr->maint) {
+		_mem_fail(MEM_ERR_CALLED_AGAIN, "mem_pool_start_maintenance(): Maintenance is already running.", pool_mgr, 0);
+		return ALLOC_CALLED_AGAIN;
+	}
 
-void mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments) {
+	// the worker is a second thread on the pool, so the pool is shared from here on
+	if (!pool_mgr->sync && _mem_share(pool_mgr) == ALLOC_FAIL)
+		return ALLOC_FAIL;
 
-	// get the mgr from the pool
-	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+	maint_pt maint = malloc(sizeof(maint_t));
 
-	// allocate the segments array with size == used_nodes
-	pool_segment_pt segs = (pool_segment_t*)malloc(sizeof(pool_segment_t) * pool_mgr->used_nodes);
+	if (maint == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_start_maintenance(): Could not allocate worker state.", pool_mgr, 0);
+		return ALLOC_FAIL;
+	}
 
-	// check successful
-	if (segs == NULL) {
-		puts("Could not inspect pool.  malloc() failed.");
-		return NULL;
+	if (pthread_cond_init(&maint->wake, NULL)) {
+		_mem_fail(MEM_ERR_SYSTEM, "mem_pool_start_maintenance(): Could not create condition variable.", pool_mgr, 0);
+		free(maint);
+		return ALLOC_FAIL;
 	}
 
-	// loop through the node heap and the segments array
-	//    for each node, write the size and allocated in the segment
-	for (int i = 0; i < pool_mgr->used_nodes; i++) {
-		segs[i].allocated = pool_mgr->node_heap[i].allocated;
-		segs[i].size = pool_mgr->node_heap[i].alloc_record.size;
+	// on before the worker starts, other threads may already be calling
+	maint->stop = 0;
+	_mem_lock(pool_mgr);
+	pool_mgr->maint = maint;
+	_mem_unlock(pool_mgr);
+
+	if (pthread_create(&maint->thread, NULL, _mem_maint_worker, pool_mgr)) {
+		_mem_fail(MEM_ERR_SYSTEM, "mem_pool_start_maintenance(): Could not start worker thread.", pool_mgr, 0);
+		_mem_lock(pool_mgr);
+		pool_mgr->maint = NULL;
+		_mem_unlock(pool_mgr);
+		pthread_cond_destroy(&maint->wake);
+		free(maint);
+		return ALLOC_FAIL;
 	}
 
+	return ALLOC_OK;
 
-	// "return" the values:
-	*segments = segs;
-	*num_segments = pool_mgr->used_nodes;
-	
 }
 
 
+alloc_status mem_pool_stop_maintenance(pool_pt pool) {
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
-static alloc_status _mem_resize_pool_store() {
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+	maint_pt maint = pool_mgr->maint;
 
-	if (pool_store_capacity > 0) {
-		if (((float)pool_store_size / (float)pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
+	if (!maint) {
+		_mem_fail(MEM_ERR_CALLED_AGAIN, "mem_pool_stop_maintenance(): Maintenance is not running.", pool_mgr, 0);
+		return ALLOC_CALLED_AGAIN;
+	}
 
-			size_t new_size = pool_store_capacity * sizeof(pool_t) * MEM_POOL_STORE_EXPAND_FACTOR;
+	// the pool stays shared, only the worker goes
+	_mem_lock(pool_mgr);
+	maint->stop = 1;
+	pthread_cond_signal(&maint->wake);
+	_mem_unlock(pool_mgr);
 
-			pool_store = (pool_pt*)realloc(pool_store, new_size);
+	pthread_join(maint->thread, NULL);
 
-			if (pool_store == NULL) {
-				puts("Could not resize pool store.  realloc() failed.");
-				return ALLOC_FAIL;
-			}
+	_mem_lock(pool_mgr);
+	pool_mgr->maint = NULL;
+	_mem_unlock(pool_mgr);
 
-		}
-	}
+	pthread_cond_destroy(&maint->wake);
+	free(maint);
 
 	return ALLOC_OK;
 
 }
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
 
-	if (pool_mgr->total_nodes > 0) {
-		if (((float)pool_mgr->used_nodes / (float)pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR) {
+unsigned mem_pool_top_tags(pool_pt pool, tag_stats_pt stats, unsigned max_tags) {
 
-			size_t new_size = pool_mgr->total_nodes * sizeof(node_t) * MEM_NODE_HEAP_EXPAND_FACTOR;
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
-			pool_mgr->node_heap = (node_pt*)realloc(pool_mgr->node_heap, new_size);
+	_mem_lock(pool_mgr);
 
-			if (pool_mgr->node_heap == NULL) {
-				puts("Could not resize node heap.  realloc() failed.");
-				return ALLOC_FAIL;
-			}
+	// every tag that was ever used, biggest live bytes first
+	tag_stats_pt all = malloc(sizeof(tag_stats_t) * pool_mgr->tags_capacity);
 
-		}
+	if (all == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_top_tags(): malloc() failed.", pool_mgr, 0);
+		_mem_unlock(pool_mgr);
+		return 0;
 	}
 
-	return ALLOC_OK;
-
-}
+	double now = _mem_now();
+	unsigned num_tags = 0;
+	for (unsigned tag = 0; tag < pool_mgr->tags_capacity; tag++) {
+		if (pool_mgr->tags[tag].allocs)
+			_mem_tag_stats(pool_mgr, tag, now, &all[num_tags++]);
+	}
 
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
-	// see above
+	_mem_unlock(pool_mgr);
 
-	//check if current size is above the threshold
-	if (((float)(pool_mgr->pool.num_gaps) / (float)(pool_mgr->gap_ix_capacity)) > MEM_GAP_IX_FILL_FACTOR) {
-	
-		size_t new_size = pool_mgr->gap_ix_capacity * sizeof(gap_t) * MEM_GAP_IX_EXPAND_FACTOR;
-		pool_mgr->gap_ix = realloc(pool_mgr->gap_ix, new_size);
+	qsort(all, num_tags, sizeof(tag_stats_t), _mem_tag_stats_cmp);
 
-		if (pool_mgr->gap_ix == NULL) {
-			puts("Could not resize gap index.  realloc() failed.");
-			return ALLOC_FAIL;
-		}
-	
-	}
+	if (num_tags > max_tags)
+		num_tags = max_tags;
+	memcpy(stats, all, sizeof(tag_stats_t) * num_tags);
+	free(all);
 
-	
-	return ALLOC_OK;
+	return num_tags;
 
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
-	size_t size,
-	node_pt node) {
-
-	// expand the gap index, if necessary (call the function)
-	if (_mem_resize_gap_ix == ALLOC_FAIL) {
-		puts("Could not resize gap index.");
-		return ALLOC_FAIL;
-	}
 
-	// add the entry at the end
-	pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = node;
-	pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = size;
+void mem_pool_dump_tags(pool_pt pool, FILE *out) {
 
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
-	// update metadata (num_gaps)
-	pool_mgr->pool.num_gaps++;
+	_mem_lock(pool_mgr);
 
+	double now = _mem_now();
 
-	// sort the gap index (call the function)
-	if (_mem_sort_gap_ix(pool_mgr) == ALLOC_FAIL) {
-		puts("Could not sort gap index.");
-		return ALLOC_FAIL;
+	unsigned num_tags = 0;
+	for (unsigned tag = 0; tag < pool_mgr->tags_capacity; tag++) {
+		if (pool_mgr->tags[tag].allocs)
+			num_tags++;
 	}
 
-	// check success
-	return ALLOC_OK;
+	// one header line, then one line per tag in tag order, all key=value so they grep and parse easily
+	fprintf(out, "mem_pool pool=%p total_size=%zu alloc_size=%zu num_allocs=%u num_gaps=%u tags=%u window=%.3f\n",
+		(void *)pool, pool->total_size, pool->alloc_size, pool->num_allocs, pool->num_gaps, num_tags, now - pool_mgr->tags_since);
 
-}
+	for (unsigned tag = 0; tag < pool_mgr->tags_capacity; tag++) {
 
-static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
-	size_t size,
-	node_pt node) {
-	// find the position of the node in the gap index
-	// loop from there to the end of the array:
-	//    pull the entries (i.e. copy over) one position up
-	//    this effectively deletes the chosen node
-	// update metadata (num_gaps)
-	// zero out the element at position num_gaps!
+		if (!pool_mgr->tags[tag].allocs)
+			continue;
 
-	size_t new_gap = node->alloc_record.size - size;
+		tag_stats_t stats;
+		_mem_tag_stats(pool_mgr, tag, now, &stats);
 
-	// update gap list
-	for (int i = 0; i < pool_mgr->pool.num_gaps; i++) {
+		fprintf(out, "mem_pool_tag pool=%p tag=%u live_bytes=%zu live_count=%u peak_bytes=%zu allocs=%lu rate=%.1f\n",
+			(void *)pool, stats.tag, stats.live_bytes, stats.live_count, stats.peak_bytes, stats.allocs, stats.alloc_rate);
 
-		node_pt n = pool_mgr->gap_ix[i].node;
+		// the next rate window starts now
+		pool_mgr->tags[tag].allocs_at_dump = pool_mgr->tags[tag].allocs;
 
-			// compare memory addresses
-		if (n->alloc_record.mem == node->alloc_record.mem) {
+	}
 
-			// there is some remaining gap left, update the currently used gap index
-			if (new_gap > 0) {
+	pool_mgr->tags_since = now;
 
-				pool_mgr->gap_ix[i].node = n->next;
-				pool_mgr->gap_ix[i].size = n->next->alloc_record.size;
+	_mem_unlock(pool_mgr);
 
-				/*
-				// find new node to hold the new gap, the old is becoming allocated
-				node_pt new_node = _mem_find_unused_node(pool_mgr);
-				if (!new_node) {
-					puts("mem_remove_from_gap_ix() : Could not find an unused node.");
+}
+
+
+// the clone starts out sharing every page with the pool, copy-on-write, and the two go their own ways after that
+// note: its alloc_pt's are its own, find them with mem_find_alloc() at the same offset from clone->mem;
+// it costs a copy of the metadata and the pages the pool wrote since the clone before, plus the live
+// data on the first clone unless the pool came from mem_pool_open_cow()
+pool_pt mem_pool_clone(pool_pt pool) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+	// the memory isn't whole pages of its own
+	if (pool_mgr->compact) {
+		_mem_fail(MEM_ERR_UNSUPPORTED, "mem_pool_clone(): Compact pools can't be cloned.", pool_mgr, 0);
+		return NULL;
+	}
+
+	if (_mem_resize_pool_store() == ALLOC_FAIL)
+		return NULL;
+
+	pool_mgr_pt clone = (pool_mgr_t*) malloc(sizeof(pool_mgr_t));
+
+	if (clone == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_clone(): Could not allocate pool manager.", pool_mgr, 0);
+		return NULL;
+	}
+
+	_mem_lock(pool_mgr);
+
+	// start from a copy of the mgr, minus everything the clone has to get for itself
+	*clone = *pool_mgr;
+	clone->pool.mem = NULL;
+	clone->node_sizes = NULL;
+	clone->node_heap = NULL;
+	clone->alloc_recs = NULL;
+	clone->rec_block = NULL;
+	clone->alloc_tags = NULL;
+	clone->alloc_order = NULL;
+	clone->gap_sizes = NULL;
+	clone->gap_nodes = NULL;
+	clone->gap_chunks = NULL;
+	clone->addr_ix = NULL;
+	clone->tags = NULL;
+	clone->adapt = NULL;
+	clone->quick = NULL;
+	clone->store_slot = MEM_NIL;
+	clone->mem_fd = -1;
+	clone->mem_shared = 0;
+	clone->sync = NULL;
+	clone->maint = NULL;
+	clone->maint_dirty = 0;
+	clone->maint_ops = 0;
+
+	// the clone starts out with the quick blocks merged, and empty lists of its own
+	alloc_status status = _mem_flush_quick(pool_mgr);
+	if (status == ALLOC_OK)
+		status = _mem_clone_pages(pool_mgr, clone);
+	if (status == ALLOC_OK)
+		status = _mem_clone_metadata(pool_mgr, clone);
+
+	_mem_unlock(pool_mgr);
+
+	if (status == ALLOC_OK && _mem_page_map_set(clone->pool.mem, _mem_pool_bytes(clone->pool.total_size), clone) == ALLOC_FAIL)
+		status = ALLOC_FAIL;
+
+	if (status == ALLOC_FAIL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_clone(): Could not clone pool.", pool_mgr, 0);
+		mem_pool_close((pool_pt) clone);
+		return NULL;
+	}
+
+	_mem_store_pool(clone);
+
+	return (pool_pt) clone;
+
+}
+
+
+// a mark is just the allocation count, everything allocated from here on is newer
+// note: the first one starts keeping the allocation order; if that fails, the mark can't be released to
+pool_mark_t mem_pool_mark(pool_pt pool) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+	_mem_lock(pool_mgr);
+
+	pool_mark_t mark = pool_mgr->alloc_seq;
+
+	// zero seqs, so allocations from before all count as older than any mark
+	if (!pool_mgr->alloc_order) {
+		pool_mgr->alloc_order = calloc(pool_mgr->total_nodes, sizeof(alloc_order_t));
+		pool_mgr->order_since = mark;
+		if (!pool_mgr->alloc_order)
+			_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_mark(): Could not allocate the allocation order.", pool_mgr, 0);
+	}
+
+	_mem_unlock(pool_mgr);
+
+	return mark;
+
+}
+
+
+// frees whatever was allocated since the mark and is still live; marks can nest, release the inner ones first
+alloc_status mem_pool_release_to(pool_pt pool, pool_mark_t mark) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+	_mem_lock(pool_mgr);
+
+	// everything allocated since the mark must have been in the order, unless there's nothing
+	int tracked = pool_mgr->alloc_order && mark >= pool_mgr->order_since;
+
+	alloc_status status = ALLOC_FAIL;
+	if (mark <= pool_mgr->alloc_seq && (tracked || mark == pool_mgr->alloc_seq))
+		status = _mem_release_to(pool_mgr, mark);
+	else
+		_mem_fail(MEM_ERR_BAD_MARK, "mem_pool_release_to(): Mark is not from this pool.", pool_mgr, 0);
+
+	_mem_unlock(pool_mgr);
+
+	return status;
+
+}
+
+
+// fixed policies report their policy as the placement, and no windows
+void mem_pool_adapt_stats(pool_pt pool, adapt_stats_pt stats) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+	_mem_lock(pool_mgr);
+
+	memset(stats, 0, sizeof(adapt_stats_t));
+	stats->placement = pool->policy;
+
+	adapt_pt adapt = pool_mgr->adapt;
+	if (adapt) {
+		stats->placement = adapt->placement;
+		stats->windows = adapt->windows;
+		stats->switches = adapt->switches;
+		stats->last = adapt->last;
+	}
+
+	_mem_unlock(pool_mgr);
+
+}
+
+
+// the latest switches, oldest first; the pool keeps only the last MEM_ADAPT_LOG of them
+unsigned mem_pool_adapt_switches(pool_pt pool, adapt_switch_pt switches, unsigned max_switches) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+	_mem_lock(pool_mgr);
+
+	adapt_pt adapt = pool_mgr->adapt;
+	unsigned num_switches = 0;
+
+	if (adapt) {
+		num_switches = adapt->switches < MEM_ADAPT_LOG ? (unsigned)adapt->switches : MEM_ADAPT_LOG;
+		if (num_switches > max_switches)
+			num_switches = max_switches;
+
+		for (unsigned i = 0; i < num_switches; i++)
+			switches[i] = adapt->log[(adapt->switches - num_switches + i) % MEM_ADAPT_LOG];
+	}
+
+	_mem_unlock(pool_mgr);
+
+	return num_switches;
+
+}
+
+
+// frees of blocks up to 1 KiB go on per-size lists instead of being merged, and the next request
+// of the same size takes the newest one back; the lists are merged into the gaps when they get
+// long, or when a request finds no gap that fits
+// note: num_gaps still counts a gap and the quick blocks next to it as one, mem_inspect_pool() merges first
+alloc_status mem_pool_enable_quick_lists(pool_pt pool) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+	if (pool_mgr->quick) {
+		_mem_fail(MEM_ERR_CALLED_AGAIN, "mem_pool_enable_quick_lists(): Quick lists are already on.", pool_mgr, 0);
+		return ALLOC_CALLED_AGAIN;
+	}
+
+	quick_pt quick = _mem_new_quick();
+
+	if (quick == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_enable_quick_lists(): Could not allocate quick lists.", pool_mgr, 0);
+		return ALLOC_FAIL;
+	}
+
+	_mem_lock(pool_mgr);
+	pool_mgr->quick = quick;
+	_mem_unlock(pool_mgr);
+
+	return ALLOC_OK;
+
+}
+
+
+mem_error mem_last_error() {
+
+	return mem_last_err;
+
+}
+
+
+const char *mem_error_str(mem_error error) {
+
+	switch (error) {
+	case MEM_ERR_NONE:         return "no error";
+	case MEM_ERR_CALLED_AGAIN: return "called again";
+	case MEM_ERR_BAD_SIZE:     return "bad size";
+	case MEM_ERR_BAD_TAG:      return "bad tag";
+	case MEM_ERR_BAD_POLICY:   return "bad allocation policy";
+	case MEM_ERR_BAD_MARK:     return "bad mark";
+	case MEM_ERR_FULL:         return "pool is full";
+	case MEM_ERR_NO_FIT:       return "no gap big enough";
+	case MEM_ERR_NO_MEMORY:    return "out of memory";
+	case MEM_ERR_NOT_FOUND:    return "allocation not found";
+	case MEM_ERR_SYSTEM:       return "system call failed";
+	case MEM_ERR_CORRUPT:      return "pool metadata is inconsistent";
+	case MEM_ERR_UNSUPPORTED:  return "not supported for this pool";
+	case MEM_ERR_TIMEOUT:      return "timed out";
+	}
+
+	return "unknown error";
+
+}
+
+
+// events that were overwritten before they could be drained show up as gaps in seq
+// note: lock-free against the writers, but only one thread should drain at a time
+unsigned mem_drain_events(mem_event_pt events, unsigned max_events) {
+
+	unsigned long head = __atomic_load_n(&mem_events_head, __ATOMIC_ACQUIRE);
+	unsigned long tail = mem_events_tail;
+	unsigned num_events = 0;
+
+	// anything more than a ring behind is gone
+	if (head - tail > MEM_EVENT_RING_CAPACITY)
+		tail = head - MEM_EVENT_RING_CAPACITY;
+
+	for (; tail != head && num_events < max_events; tail++) {
+
+		mem_event_slot_pt slot = &mem_events[tail & (MEM_EVENT_RING_CAPACITY - 1)];
+		unsigned long state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+
+		// still being written, pick it up next time
+		if (state < 2 * tail + 2)
+			break;
+
+		// overwritten already, or while we copied it
+		mem_event_t event;
+		__atomic_load(&slot->event.error, &event.error, __ATOMIC_RELAXED);
+		__atomic_load(&slot->event.what, &event.what, __ATOMIC_RELAXED);
+		__atomic_load(&slot->event.pool, &event.pool, __ATOMIC_RELAXED);
+		__atomic_load(&slot->event.size, &event.size, __ATOMIC_RELAXED);
+		__atomic_load(&slot->event.time, &event.time, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (state != 2 * tail + 2 || __atomic_load_n(&slot->state, __ATOMIC_RELAXED) != state)
+			continue;
+
+		event.seq = tail;
+		events[num_events++] = event;
+
+	}
+
+	mem_events_tail = tail;
+
+	return num_events;
+
+}
+
+
+void mem_dump_events(FILE *out) {
+
+	mem_event_t events[32];
+	unsigned num_events;
+
+	// same key=value lines as mem_pool_dump_tags()
+	while ((num_events = mem_drain_events(events, 32))) {
+		for (unsigned i = 0; i < num_events; i++) {
+			fprintf(out, "mem_pool_event seq=%lu time=%.6f error=%d pool=%p size=%zu what=\"%s\"\n",
+				events[i].seq, events[i].time, (int)events[i].error, (void *)events[i].pool, events[i].size, events[i].what);
+		}
+	}
+
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// note: dirty, if not NULL, gets the bytes up front that may not be zero
+static alloc_pt _mem_new_alloc(pool_mgr_pt pool_mgr, size_t size, unsigned tag, uint32_t *dirty_out) {
+
+	pool_pt pool = &pool_mgr->pool;
+
+
+	// size sanity check
+	if (size > pool->total_size) {
+		_mem_fail(MEM_ERR_BAD_SIZE, "mem_new_alloc(): Requested size is greater than the total pool size.", pool_mgr, size);
+		return NULL;
+	}
+
+	// zero-size allocations can't be told apart from unused nodes
+	if (!size) {
+		_mem_fail(MEM_ERR_BAD_SIZE, "mem_new_alloc(): Requested size is zero.", pool_mgr, size);
+		return NULL;
+	}
+
+
+	// check if any gaps, return null if none
+	if (!pool->num_gaps) {
+		_mem_fail(MEM_ERR_FULL, "mem_new_alloc(): No gaps available.", pool_mgr, size);
+		return NULL;
+	}
+
+
+	// expand heap node, if necessary, quit on error
+	if (_mem_resize_node_heap(pool_mgr, MEM_NODE_HEAP_FILL_FACTOR) == ALLOC_FAIL)
+		return NULL;
+
+
+	// check used nodes fewer than total nodes, quit on error
+	if (pool_mgr->used_nodes > pool_mgr->total_nodes)
+	{
+		_mem_fail(MEM_ERR_CORRUPT, "mem_new_alloc(): Unknown error: number of used nodes exceeds the total nodes.", pool_mgr, size);
+		return NULL;
+	}
+
+
+
+
+	// ADAPTIVE places with one of the other two, and samples the request
+	// note: this is a safe point to switch, every pool keeps both the node sizes and the gap index current
+	alloc_policy placement = pool->policy;
+	adapt_pt adapt = pool_mgr->adapt;
+
+	if (adapt) {
+		if (adapt->allocs == MEM_ADAPT_WINDOW)
+			_mem_adapt(pool_mgr);
+
+		placement = adapt->placement;
+		adapt->allocs++;
+		adapt->size_sum += (double)size;
+		adapt->size_sq_sum += (double)size * (double)size;
+		if (size < adapt->min_size)
+			adapt->min_size = size;
+	}
+
+	if (placement != FIRST_FIT && placement != BEST_FIT) {
+		_mem_fail(MEM_ERR_BAD_POLICY, "mem_new_alloc(): Unknown allocation policy.", pool_mgr, size);
+		return NULL;
+	}
+
+
+
+
+	// get a node for allocation:
+	// a block of exactly this size on a quick list goes back out as it is
+	// otherwise search the gaps; if none fits, merge the quick lists into them and search again
+	uint32_t node = _mem_quick_find(pool_mgr, size);
+	int from_quick = node != MEM_NIL;
+
+	if (!from_quick)
+		node = _mem_find_gap(pool_mgr, placement, size);
+
+	if (node == MEM_NIL && pool_mgr->quick && pool_mgr->quick->count) {
+		if (_mem_flush_quick(pool_mgr) == ALLOC_FAIL)
+			return NULL;
+		node = _mem_find_gap(pool_mgr, placement, size);
+	}
+
+
+	// check if node found
+	if (node == MEM_NIL) {
+		_mem_fail(MEM_ERR_NO_FIT, "mem_new_alloc(): Could not find a suitable node.", pool_mgr, size);
+		return NULL;
+	}
+
+
+	// Handle the remaining gap
+	// note: a quick block is the exact size, and may all have been written
+	size_t gap_size = from_quick ? size : pool_mgr->node_sizes[node];
+	size_t new_gap = gap_size - size;
+	uint32_t dirty = from_quick ? (uint32_t)size : pool_mgr->node_heap[node].aux;
+
+
+	// make room in the address index and the tag stats, and, if there is a
+	// remaining gap, get a node for it before changing anything
+	if (_mem_resize_addr_ix(pool_mgr, MEM_ADDR_IX_FILL_FACTOR) == ALLOC_FAIL)
+		return NULL;
+
+	if (_mem_resize_tags(pool_mgr, tag) == ALLOC_FAIL)
+		return NULL;
+
+	// the first tag other than 0 starts keeping one per node, untagged ones read 0
+	if (tag && !pool_mgr->alloc_tags) {
+		pool_mgr->alloc_tags = calloc(pool_mgr->total_nodes, sizeof(uint32_t));
+		if (!pool_mgr->alloc_tags) {
+			_mem_fail(MEM_ERR_NO_MEMORY, "mem_new_alloc(): Could not allocate allocation tags.", pool_mgr, size);
+			return NULL;
+		}
+	}
+
+	uint32_t new_node = MEM_NIL;
+
+	if (new_gap) {
+		new_node = _mem_find_unused_node(pool_mgr);
+
+		if (new_node == MEM_NIL) {
+			_mem_fail(MEM_ERR_NO_MEMORY, "mem_new_alloc(): Could not find unused node.", pool_mgr, size);
+			return NULL;
+		}
+	}
+
+
+
+
+	// take the whole gap out of the gap index, the remainder goes back in below
+	if (from_quick)
+		_mem_quick_pop(pool_mgr, size);
+	else if (_mem_remove_from_gap_ix(pool_mgr, gap_size, node) == ALLOC_FAIL)
+		return NULL;
+
+
+	// adjust node heap:
+	//   if remaining gap, need a new node
+	if (new_gap) {
+
+		node_pt n = &pool_mgr->node_heap[node];
+		node_pt nn = &pool_mgr->node_heap[new_node];
+
+		//   initialize it to a gap node
+		pool_mgr->node_sizes[new_node] = (uint32_t)new_gap;
+		nn->next = n->next;
+		nn->prev = node;
+		nn->offset = n->offset + (uint32_t)size;
+		nn->aux = dirty > size ? dirty - (uint32_t)size : 0;
+
+		//   update linked list (new node right after the node for allocation)
+		if (n->next != MEM_NIL)
+			pool_mgr->node_heap[n->next].prev = new_node;
+		n->next = new_node;
+
+
+		//   update metadata (used_nodes)
+		pool_mgr->used_nodes++;
+
+
+		// update gap list
+		if (_mem_add_to_gap_ix(pool_mgr, new_gap, new_node) == ALLOC_FAIL)
+			return NULL;
+
+	}
+
+
+
+
+
+
+	// update metadata (num_allocs, alloc_size, num_gaps)
+	// note: the node leaves its free run, which splits in two if there's free space on both sides
+	pool_mgr->node_sizes[node] = MEM_SEG_ALLOCATED | (uint32_t)size;
+	pool->num_gaps = pool->num_gaps + _mem_free_neighbours(pool_mgr, node) - 1;
+
+	uint32_t rec = _mem_new_alloc_rec(pool_mgr);
+	alloc_rec_pt alloc_rec = &pool_mgr->alloc_recs[rec];
+	alloc_rec->alloc.mem = pool->mem + pool_mgr->node_heap[node].offset;
+	alloc_rec->alloc.size = size;
+	alloc_rec->node = node;
+	pool_mgr->node_heap[node].aux = rec;
+	_mem_add_to_addr_ix(pool_mgr, node);
+
+	if (dirty_out)
+		*dirty_out = dirty < size ? dirty : (uint32_t)size;
+
+	if (pool_mgr->alloc_tags)
+		pool_mgr->alloc_tags[node] = tag;
+
+	// newest at the head of the allocation order, once there is one
+	alloc_order_pt order = pool_mgr->alloc_order;
+	if (order) {
+		order[node].seq = pool_mgr->alloc_seq;
+		order[node].older = pool_mgr->newest_alloc;
+		order[node].newer = MEM_NIL;
+		if (pool_mgr->newest_alloc != MEM_NIL)
+			order[pool_mgr->newest_alloc].newer = node;
+		pool_mgr->newest_alloc = node;
+	}
+	pool_mgr->alloc_seq++;
+
+	tag_rec_pt tag_rec = &pool_mgr->tags[tag];
+	tag_rec->live_bytes += size;
+	tag_rec->live_count++;
+	tag_rec->allocs++;
+	if (tag_rec->live_bytes > tag_rec->peak_bytes)
+		tag_rec->peak_bytes = tag_rec->live_bytes;
+
+	pool->num_allocs++;
+	pool->alloc_size += size;
+	pool_mgr->maint_ops++;
+
+
+
+
+
+	// return the allocation record
+	return &alloc_rec->alloc;
+
+}
+
+// if FIRST_FIT, then find the first sufficient node in the node heap
+// if BEST_FIT, then find the first sufficient node in the gap index
+// note: both only touch the size arrays, never the nodes themselves
+static uint32_t _mem_find_gap(pool_mgr_pt pool_mgr, alloc_policy placement, size_t size) {
+
+	adapt_pt adapt = pool_mgr->adapt;
+	uint32_t node = MEM_NIL;
+
+	if (placement == FIRST_FIT) {
+
+
+		// scan the node sizes (only gaps are positive) with the vector kernel
+		size_t i = _mem_find_fit(pool_mgr->node_sizes, pool_mgr->total_nodes, size);
+
+		if (i < pool_mgr->total_nodes)
+			node = (uint32_t)i;
+
+		if (adapt) {
+			adapt->scan_sum += i < pool_mgr->total_nodes ? i + 1 : i;
+			adapt->scans++;
+		}
+
+
+	}
+	else {
+
+
+		// the gap index is sorted, so the first sufficient gap is the best one
+		unsigned i;
+		unsigned c = _mem_gap_ix_find(pool_mgr, size, 0, &i);
+
+		if (c < pool_mgr->gap_num_chunks)
+			node = pool_mgr->gap_nodes[pool_mgr->gap_chunks[c].chunk * pool_mgr->gap_chunk_size + i];
+
+		// what a FIRST_FIT search would read, once a window
+		if (adapt && !adapt->scans) {
+			size_t j = _mem_find_fit(pool_mgr->node_sizes, pool_mgr->total_nodes, size);
+			adapt->scan_sum += j < pool_mgr->total_nodes ? j + 1 : j;
+			adapt->scans++;
+		}
+
+
+	}
+
+	return node;
+
+}
+
+
+// note: the caller has found the record
+static alloc_status _mem_del_alloc(pool_mgr_pt pool_mgr, alloc_rec_pt rec) {
+
+	// this is node-to-delete
+	uint32_t node_to_delete = rec->node;
+	uint32_t size = pool_mgr->node_sizes[node_to_delete] & MEM_SEG_SIZE_MASK;
+
+	// update metadata and give the record back
+	// note: the node joins the free runs next to it, or is one of its own
+	_mem_drop_alloc_rec(pool_mgr, rec);
+	pool_mgr->pool.num_gaps = pool_mgr->pool.num_gaps + 1 - _mem_free_neighbours(pool_mgr, node_to_delete);
+
+	// small blocks wait on a quick list for the next request of their size, unmerged;
+	// not while anyone waits though, they're woken by merged gaps
+	quick_pt quick = pool_mgr->quick;
+
+	if (quick && size <= MEM_QUICK_MAX_SIZE && !(pool_mgr->sync && pool_mgr->sync->wait_head)) {
+
+		// full lists are all merged first, so they only ever hold the latest frees
+		if (quick->count == MEM_QUICK_MAX_BLOCKS && _mem_flush_quick(pool_mgr) == ALLOC_FAIL)
+			return ALLOC_FAIL;
+
+		if (_mem_quick_push(pool_mgr, node_to_delete, size))
+			return ALLOC_OK;
+
+	}
+
+	return _mem_merge_gap(pool_mgr, node_to_delete, size);
+
+}
+
+// turns a freed node into a gap, merged with the gaps on either side
+// note: quick blocks next to it stay where they are, they're merged when their list is
+static alloc_status _mem_merge_gap(pool_mgr_pt pool_mgr, uint32_t node_to_delete, uint32_t size) {
+
+	// only a next gap's known-zero tail survives the merges, the allocation itself may have been written
+	uint32_t clean = 0;
+
+
+
+	// if the next node in the list is also a gap, merge into node-to-delete
+	uint32_t next_node = pool_mgr->node_heap[node_to_delete].next;
+	if (next_node != MEM_NIL) {
+		uint32_t next_size = pool_mgr->node_sizes[next_node];
+
+		// next_node is also a gap
+		if (!(next_size & MEM_SEG_ALLOCATED)) {
+
+			//   remove the next node from gap index
+			if (_mem_remove_from_gap_ix(pool_mgr, next_size, next_node) == ALLOC_FAIL)
+				return ALLOC_FAIL;
+
+			//   add the size to the node-to-delete
+			size += next_size;
+			clean = next_size - pool_mgr->node_heap[next_node].aux;
+			//   update linked list:
+			pool_mgr->node_heap[node_to_delete].next = pool_mgr->node_heap[next_node].next;
+			if (pool_mgr->node_heap[next_node].next != MEM_NIL)
+				pool_mgr->node_heap[pool_mgr->node_heap[next_node].next].prev = node_to_delete;
+
+			//   update node as unused
+			_mem_release_node(pool_mgr, next_node);
+
+		}
+	}
+
+
+
+	// this merged node-to-delete might need to be added to the gap index
+	// but one more thing to check...
+	// if the previous node in the list is also a gap, merge into previous!
+	uint32_t prev_node = pool_mgr->node_heap[node_to_delete].prev;
+	if (prev_node != MEM_NIL) {
+		uint32_t prev_size = pool_mgr->node_sizes[prev_node];
+
+		if (!(prev_size & MEM_SEG_ALLOCATED)) {
+
+			//   remove the previous node from gap index
+			if (_mem_remove_from_gap_ix(pool_mgr, prev_size, prev_node) == ALLOC_FAIL)
+				return ALLOC_FAIL;
+
+			//   add the size of node-to-delete to the previous
+			size += prev_size;
+			pool_mgr->node_heap[prev_node].next = pool_mgr->node_heap[node_to_delete].next;
+			if (pool_mgr->node_heap[prev_node].next != MEM_NIL)
+				pool_mgr->node_heap[pool_mgr->node_heap[prev_node].next].prev = prev_node;
+
+			//   update node-to-delete as unused
+			_mem_release_node(pool_mgr, node_to_delete);
+
+			node_to_delete = prev_node;
+
+		}
+	}
+
+
+
+	// convert to gap node
+	pool_mgr->node_sizes[node_to_delete] = size;
+	pool_mgr->node_heap[node_to_delete].aux = size - clean;
+
+	if (_mem_add_to_gap_ix(pool_mgr, size, node_to_delete) == ALLOC_FAIL)
+		return ALLOC_FAIL;
+
+	_mem_wake_waiter(pool_mgr, size);
+
+	return ALLOC_OK;
+
+}
+
+static alloc_status _mem_resize_pool_store() {
+
+	if (pool_store_capacity > 0) {
+		if (((float)pool_store_size / (float)pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR) {
+
+			unsigned new_capacity = pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+
+			pool_mgr_pt *new_store = (pool_mgr_pt*)realloc(pool_store, sizeof(pool_mgr_pt) * new_capacity);
+
+			if (new_store == NULL) {
+				_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_pool_store(): Could not resize pool store.  realloc() failed.", NULL, 0);
+				return ALLOC_FAIL;
+			}
+
+			for (unsigned i = pool_store_capacity; i < new_capacity; i++)
+				new_store[i] = NULL;
+
+			pool_store = new_store;
+
+			unsigned *new_free = (unsigned*)realloc(pool_store_free, sizeof(unsigned) * new_capacity);
+
+			if (new_free == NULL) {
+				_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_pool_store(): Could not resize pool store.  realloc() failed.", NULL, 0);
+				return ALLOC_FAIL;
+			}
+
+			pool_store_free = new_free;
+			pool_store_capacity = new_capacity;
+
+		}
+	}
+
+	return ALLOC_OK;
+
+}
+
+// reuse an emptied spot if there is one, otherwise tack it on to the end
+// note: _mem_resize_pool_store() must have made room first
+static void _mem_store_pool(pool_mgr_pt pool_mgr) {
+
+	unsigned x;
+	if (pool_store_num_free)
+		x = pool_store_free[--pool_store_num_free];
+	else
+		x = pool_store_size++;  // we must increase the size
+
+	pool_store[x] = pool_mgr;
+	pool_mgr->store_slot = x;
+
+}
+
+// a compact pool's first arrays are part of its block, and can't be freed or realloc()'d
+static int _mem_in_block(pool_mgr_pt pool_mgr, const void *array) {
+
+	return pool_mgr->compact && (const char *)array > (const char *)pool_mgr && (const char *)array < pool_mgr->pool.mem;
+
+}
+
+static void *_mem_realloc_array(pool_mgr_pt pool_mgr, void *array, size_t bytes, size_t new_bytes) {
+
+	if (!_mem_in_block(pool_mgr, array))
+		return realloc(array, new_bytes);
+
+	void *new_array = malloc(new_bytes);
+	if (new_array)
+		memcpy(new_array, array, bytes);
+
+	return new_array;
+
+}
+
+static void _mem_free_array(pool_mgr_pt pool_mgr, void *array) {
+
+	if (!_mem_in_block(pool_mgr, array))
+		free(array);
+
+}
+
+// compact pools have no reservation to grow into, the nodes are copied to bigger arrays
+// note: node_sizes is 32-byte aligned for the vector kernels, and new nodes start out unused;
+// the old records stay until the pool is closed, the alloc_pt's into them still read right,
+// and _mem_find_alloc_rec() takes them for copies
+static alloc_status _mem_resize_compact_nodes(pool_mgr_pt pool_mgr, size_t new_total) {
+
+	size_t total = pool_mgr->total_nodes;
+	uint32_t *node_sizes = aligned_alloc(32, (sizeof(uint32_t) * new_total + 31) & ~(size_t)31);
+	node_pt node_heap = malloc(sizeof(node_t) * new_total);
+	rec_block_pt block = malloc(sizeof(rec_block_t) + sizeof(alloc_rec_t) * new_total);
+
+	if (!node_sizes || !node_heap || !block) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_compact_nodes(): Could not resize node heap.  malloc() failed.", pool_mgr, 0);
+		free(node_sizes);
+		free(node_heap);
+		free(block);
+		return ALLOC_FAIL;
+	}
+
+	memcpy(node_sizes, pool_mgr->node_sizes, sizeof(uint32_t) * total);
+	memset(&node_sizes[total], 0, sizeof(uint32_t) * (new_total - total));
+	memcpy(node_heap, pool_mgr->node_heap, sizeof(node_t) * total);
+	memcpy(block->recs, pool_mgr->alloc_recs, sizeof(alloc_rec_t) * pool_mgr->recs_used);
+
+	_mem_free_array(pool_mgr, pool_mgr->node_sizes);
+	_mem_free_array(pool_mgr, pool_mgr->node_heap);
+	pool_mgr->node_sizes = node_sizes;
+	pool_mgr->node_heap = node_heap;
+
+	block->prev = pool_mgr->rec_block;
+	block->bytes = 0;
+	pool_mgr->rec_block = block;
+	pool_mgr->alloc_recs = block->recs;
+
+	return ALLOC_OK;
+
+}
+
+// past its reservations a pool moves its nodes to bigger ones, doubling them up to max_nodes
+// note: the node arrays are only ever indexed, so the old ones go; the old records keep their
+// committed pages until the pool is closed, the alloc_pt's into them still read right, and
+// _mem_find_alloc_rec() takes them for copies
+static alloc_status _mem_move_nodes(pool_mgr_pt pool_mgr, size_t new_total) {
+
+	size_t total = pool_mgr->total_nodes;
+	size_t reserved = pool_mgr->reserved_nodes;
+
+	while (reserved < new_total)
+		reserved *= MEM_NODE_HEAP_EXPAND_FACTOR;
+	if (reserved > pool_mgr->max_nodes)
+		reserved = pool_mgr->max_nodes;
+
+	uint32_t *node_sizes = _mem_reserve(sizeof(uint32_t) * reserved);
+	node_pt node_heap = _mem_reserve(sizeof(node_t) * reserved);
+	rec_block_pt block = _mem_reserve(_mem_rec_block_bytes(reserved));
+
+	if (!node_sizes || !node_heap || !block
+		|| _mem_commit(node_sizes, sizeof(uint32_t) * new_total) == ALLOC_FAIL
+		|| _mem_commit(node_heap, sizeof(node_t) * new_total) == ALLOC_FAIL
+		|| _mem_commit(block, _mem_rec_block_bytes(new_total)) == ALLOC_FAIL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "_mem_move_nodes(): Could not move node heap.  mmap() failed.", pool_mgr, 0);
+		_mem_unreserve(node_sizes, sizeof(uint32_t) * reserved);
+		_mem_unreserve(node_heap, sizeof(node_t) * reserved);
+		_mem_unreserve(block, _mem_rec_block_bytes(reserved));
+		return ALLOC_FAIL;
+	}
+
+	memcpy(node_sizes, pool_mgr->node_sizes, sizeof(uint32_t) * total);
+	memcpy(node_heap, pool_mgr->node_heap, sizeof(node_t) * total);
+	memcpy(block->recs, pool_mgr->alloc_recs, sizeof(alloc_rec_t) * pool_mgr->recs_used);
+
+	_mem_unreserve(pool_mgr->node_sizes, sizeof(uint32_t) * pool_mgr->reserved_nodes);
+	_mem_unreserve(pool_mgr->node_heap, sizeof(node_t) * pool_mgr->reserved_nodes);
+
+	// the rest of the old records' reservation was never used
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	rec_block_pt old = pool_mgr->rec_block;
+	size_t kept = (_mem_rec_block_bytes(pool_mgr->recs_used) + page - 1) & ~(page - 1);
+	if (kept < old->bytes) {
+		_mem_unreserve((char *)old + kept, old->bytes - kept);
+		old->bytes = kept;
+	}
+
+	block->prev = old;
+	block->bytes = _mem_rec_block_bytes(reserved);
+
+	pool_mgr->node_sizes = node_sizes;
+	pool_mgr->node_heap = node_heap;
+	pool_mgr->rec_block = block;
+	pool_mgr->alloc_recs = block->recs;
+	pool_mgr->reserved_nodes = reserved;
+
+	return ALLOC_OK;
+
+}
+
+// a record array with its header in front
+static size_t _mem_rec_block_bytes(size_t recs) {
+
+	return sizeof(rec_block_t) + sizeof(alloc_rec_t) * recs;
+
+}
+
+// the pool's record arrays, the current one and every one it outgrew
+static void _mem_close_rec_blocks(pool_mgr_pt pool_mgr) {
+
+	while (pool_mgr->rec_block) {
+		rec_block_pt prev = pool_mgr->rec_block->prev;
+		if (pool_mgr->rec_block->bytes)
+			_mem_unreserve(pool_mgr->rec_block, pool_mgr->rec_block->bytes);
+		else
+			free(pool_mgr->rec_block);
+		pool_mgr->rec_block = prev;
+	}
+
+}
+
+// the per-node extras that are on keep up with the nodes, new entries start out zero
+static alloc_status _mem_resize_node_extras(pool_mgr_pt pool_mgr, size_t new_total) {
+
+	size_t total = pool_mgr->total_nodes;
+
+	if (pool_mgr->alloc_tags) {
+		uint32_t *alloc_tags = realloc(pool_mgr->alloc_tags, sizeof(uint32_t) * new_total);
+		if (alloc_tags == NULL)
+			return ALLOC_FAIL;
+		memset(&alloc_tags[total], 0, sizeof(uint32_t) * (new_total - total));
+		pool_mgr->alloc_tags = alloc_tags;
+	}
+
+	if (pool_mgr->alloc_order) {
+		alloc_order_pt alloc_order = realloc(pool_mgr->alloc_order, sizeof(alloc_order_t) * new_total);
+		if (alloc_order == NULL)
+			return ALLOC_FAIL;
+		memset(&alloc_order[total], 0, sizeof(alloc_order_t) * (new_total - total));
+		pool_mgr->alloc_order = alloc_order;
+	}
+
+	return ALLOC_OK;
+
+}
+
+static void _mem_close_compact(pool_mgr_pt pool_mgr) {
+
+	_mem_free_array(pool_mgr, pool_mgr->node_sizes);
+	_mem_free_array(pool_mgr, pool_mgr->node_heap);
+	_mem_free_array(pool_mgr, pool_mgr->gap_sizes);
+	_mem_free_array(pool_mgr, pool_mgr->gap_nodes);
+	_mem_free_array(pool_mgr, pool_mgr->gap_chunks);
+	_mem_free_array(pool_mgr, pool_mgr->addr_ix);
+	_mem_free_array(pool_mgr, pool_mgr->tags);
+	free(pool_mgr->alloc_tags);
+	free(pool_mgr->alloc_order);
+	free(pool_mgr->adapt);
+	free(pool_mgr->quick);
+	_mem_close_rec_blocks(pool_mgr);
+
+	// off the list
+	if (pool_mgr->compact_prev)
+		pool_mgr->compact_prev->compact_next = pool_mgr->compact_next;
+	else
+		compact_pools = pool_mgr->compact_next;
+	if (pool_mgr->compact_next)
+		pool_mgr->compact_next->compact_prev = pool_mgr->compact_prev;
+
+	free(pool_mgr);
+
+}
+
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr, float fill_factor) {
+
+	if (pool_mgr->total_nodes > 0) {
+		if (((float)pool_mgr->used_nodes / (float)pool_mgr->total_nodes) > fill_factor) {
+
+			size_t new_total = (size_t)pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
+			if (new_total > pool_mgr->max_nodes)
+				new_total = pool_mgr->max_nodes;
+			if (new_total == pool_mgr->total_nodes)
+				return ALLOC_OK;
+
+			// the extras go first, they're only ever bigger than they need to be
+			if (_mem_resize_node_extras(pool_mgr, new_total) == ALLOC_FAIL) {
+				_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_node_heap(): Could not resize node heap.  realloc() failed.", pool_mgr, 0);
+				return ALLOC_FAIL;
+			}
+
+			// compact pools copy theirs out; otherwise the heap grows in place until its
+			// reservations are full, and moves to bigger ones; node indices stay valid either way
+			if (pool_mgr->compact) {
+				if (_mem_resize_compact_nodes(pool_mgr, new_total) == ALLOC_FAIL)
 					return ALLOC_FAIL;
-				}
-
-				// update metadata for new_node
-				new_node->used = 1;
-				new_node->allocated = 0;
-				new_node->alloc_record.size = new_gap;
-				new_node->alloc_record.mem = n->alloc_record.mem + size;
-
-				//put it in the linked list node heap
-				new_node->prev = n;
-				new_node->next = n->next;
-				n->next = new_node;
-
-				// we have a new gap node
-				pool_mgr->used_nodes++;
-
-				// just slap it in the old gap's index, then sort
-				pool_mgr->gap_ix[i].node = new_node;
-				pool_mgr->gap_ix[i].size = new_gap;
-				_mem_sort_gap_ix(pool_mgr);
-				*/
 			}
-			else { // there is no remaining gap, remove from gap list
+			else if (new_total > pool_mgr->reserved_nodes) {
+				if (_mem_move_nodes(pool_mgr, new_total) == ALLOC_FAIL)
+					return ALLOC_FAIL;
+			}
+			else if (_mem_commit(pool_mgr->node_sizes, sizeof(uint32_t) * new_total) == ALLOC_FAIL
+				|| _mem_commit(pool_mgr->node_heap, sizeof(node_t) * new_total) == ALLOC_FAIL
+				|| _mem_commit(pool_mgr->rec_block, _mem_rec_block_bytes(new_total)) == ALLOC_FAIL) {
+				_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_node_heap(): Could not resize node heap.  mprotect() failed.", pool_mgr, 0);
+				return ALLOC_FAIL;
+			}
+
+			// new nodes start out unused: their sizes are zero (fresh pages, or cleared), and
+			// nothing else of theirs is read until they're used, so their pages aren't touched
+
+			pool_mgr->total_nodes = (unsigned)new_total;
+
+		}
+	}
+
+	return ALLOC_OK;
+
+}
+
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr, float fill_factor) {
+	// see above
+
+	//check if current size is above the threshold
+	if (_mem_gap_ix_full(pool_mgr, fill_factor)) {
+
+		// one chunk until it would be bigger than MEM_GAP_IX_CHUNK, then whole ones
+		unsigned new_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
+		unsigned chunk_size = new_capacity < MEM_GAP_IX_CHUNK ? new_capacity : MEM_GAP_IX_CHUNK;
+		new_capacity = (new_capacity + chunk_size - 1) / chunk_size * chunk_size;
+		unsigned num_chunks = new_capacity / chunk_size;
+
+		uint32_t *new_sizes = malloc(sizeof(uint32_t) * new_capacity);
+		uint32_t *new_nodes = malloc(sizeof(uint32_t) * new_capacity);
+		gap_chunk_pt new_chunks = malloc(sizeof(gap_chunk_t) * num_chunks);
+
+		if (!new_sizes || !new_nodes || !new_chunks) {
+			_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_gap_ix(): Could not resize gap index.  malloc() failed.", pool_mgr, 0);
+			free(new_sizes);
+			free(new_nodes);
+			free(new_chunks);
+			return ALLOC_FAIL;
+		}
+
+		// copy the entries over in order, filling the chunks
+		unsigned n = 0;
+		for (unsigned c = 0; c < pool_mgr->gap_num_chunks; c++) {
+			unsigned base = pool_mgr->gap_chunks[c].chunk * pool_mgr->gap_chunk_size;
+			memcpy(&new_sizes[n], &pool_mgr->gap_sizes[base], sizeof(uint32_t) * pool_mgr->gap_chunks[c].len);
+			memcpy(&new_nodes[n], &pool_mgr->gap_nodes[base], sizeof(uint32_t) * pool_mgr->gap_chunks[c].len);
+			n += pool_mgr->gap_chunks[c].len;
+		}
+
+		for (unsigned c = 0; c < num_chunks; c++) {
+			new_chunks[c].chunk = c;
+			new_chunks[c].len = n > c * chunk_size ? (n - c * chunk_size < chunk_size ? n - c * chunk_size : chunk_size) : 0;
+		}
+
+		_mem_free_array(pool_mgr, pool_mgr->gap_sizes);
+		_mem_free_array(pool_mgr, pool_mgr->gap_nodes);
+		_mem_free_array(pool_mgr, pool_mgr->gap_chunks);
+
+		pool_mgr->gap_sizes = new_sizes;
+		pool_mgr->gap_nodes = new_nodes;
+		pool_mgr->gap_chunks = new_chunks;
+		pool_mgr->gap_num_chunks = (n + chunk_size - 1) / chunk_size;
+		pool_mgr->gap_chunk_size = chunk_size;
+		pool_mgr->gap_ix_capacity = new_capacity;
+
+	}
+
+
+	return ALLOC_OK;
+
+}
+
+// one chunk is full past the fill factor, more are once they leave too few empty ones to split into
+// note: under the fill factor, a full chunk always has an empty one to split into
+static int _mem_gap_ix_full(pool_mgr_pt pool_mgr, float fill_factor) {
+
+	unsigned num_chunks = pool_mgr->gap_ix_capacity / pool_mgr->gap_chunk_size;
+
+	if (num_chunks == 1)
+		return (float)(pool_mgr->gap_ix_size + 1) / (float)pool_mgr->gap_ix_capacity > fill_factor;
+
+	return (float)(pool_mgr->gap_num_chunks + 1) / (float)num_chunks > fill_factor;
+
+}
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
+	size_t size,
+	uint32_t node) {
+
+	// expand the gap index, if necessary (call the function)
+	if (_mem_resize_gap_ix(pool_mgr, MEM_GAP_IX_FILL_FACTOR) == ALLOC_FAIL)
+		return ALLOC_FAIL;
+
+	// the index stays sorted by size, then node, so the spot is a binary search away
+	unsigned chunk_size = pool_mgr->gap_chunk_size;
+	unsigned i;
+	unsigned c = _mem_gap_ix_find(pool_mgr, size, node, &i);
+	gap_chunk_pt chunks = pool_mgr->gap_chunks;
+
+	// past the end goes at the end of the last chunk, into the first one if there's none
+	if (c == pool_mgr->gap_num_chunks) {
+		if (c == 0)
+			pool_mgr->gap_num_chunks = 1;
+		else
+			i = chunks[--c].len;
+	}
+
+	// a full chunk gives its upper half to an empty one, next to it in index order
+	if (chunks[c].len == chunk_size) {
+
+		gap_chunk_t split = chunks[pool_mgr->gap_num_chunks];
+		unsigned half = chunk_size / 2;
+		unsigned from = chunks[c].chunk * chunk_size + half, to = split.chunk * chunk_size;
+
+		memcpy(&pool_mgr->gap_sizes[to], &pool_mgr->gap_sizes[from], sizeof(uint32_t) * (chunk_size - half));
+		memcpy(&pool_mgr->gap_nodes[to], &pool_mgr->gap_nodes[from], sizeof(uint32_t) * (chunk_size - half));
+		memmove(&chunks[c + 2], &chunks[c + 1], sizeof(gap_chunk_t) * (pool_mgr->gap_num_chunks - c - 1));
+		split.len = chunk_size - half;
+		chunks[c + 1] = split;
+		chunks[c].len = half;
+		pool_mgr->gap_num_chunks++;
+
+		if (i > half) {
+			c++;
+			i -= half;
+		}
+
+	}
+
+	// shift the bigger gaps in the chunk down one and insert the entry
+	unsigned base = chunks[c].chunk * chunk_size;
+	memmove(&pool_mgr->gap_sizes[base + i + 1], &pool_mgr->gap_sizes[base + i], sizeof(uint32_t) * (chunks[c].len - i));
+	memmove(&pool_mgr->gap_nodes[base + i + 1], &pool_mgr->gap_nodes[base + i], sizeof(uint32_t) * (chunks[c].len - i));
+	pool_mgr->gap_sizes[base + i] = (uint32_t)size;
+	pool_mgr->gap_nodes[base + i] = node;
+	chunks[c].len++;
+
+
+	// update metadata (gap_ix_size)
+	pool_mgr->gap_ix_size++;
+
+
+	// check success
+	return ALLOC_OK;
+
+}
+
+static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
+	size_t size,
+	uint32_t node) {
+
+	// the same binary search the insert did, however many gaps share the size
+	unsigned chunk_size = pool_mgr->gap_chunk_size;
+	unsigned i;
+	unsigned c = _mem_gap_ix_find(pool_mgr, size, node, &i);
+	gap_chunk_pt chunks = pool_mgr->gap_chunks;
+	unsigned base = c < pool_mgr->gap_num_chunks ? chunks[c].chunk * chunk_size : 0;
+
+	if (c < pool_mgr->gap_num_chunks && pool_mgr->gap_sizes[base + i] == size && pool_mgr->gap_nodes[base + i] == node) {
+
+		// pull the rest of the chunk up one
+		memmove(&pool_mgr->gap_sizes[base + i], &pool_mgr->gap_sizes[base + i + 1], sizeof(uint32_t) * (chunks[c].len - i - 1));
+		memmove(&pool_mgr->gap_nodes[base + i], &pool_mgr->gap_nodes[base + i + 1], sizeof(uint32_t) * (chunks[c].len - i - 1));
+		chunks[c].len--;
+
+		// decrease gap count
+		pool_mgr->gap_ix_size--;
+
+		// an empty chunk goes, and so does one that fits in half of one with a neighbour, so they don't end up mostly empty
+		if (chunks[c].len == 0) {
+			_mem_gap_ix_drop_chunk(pool_mgr, c);
+		}
+		else if (c > 0 && chunks[c - 1].len + chunks[c].len <= chunk_size / 2) {
+			memcpy(&pool_mgr->gap_sizes[chunks[c - 1].chunk * chunk_size + chunks[c - 1].len], &pool_mgr->gap_sizes[base], sizeof(uint32_t) * chunks[c].len);
+			memcpy(&pool_mgr->gap_nodes[chunks[c - 1].chunk * chunk_size + chunks[c - 1].len], &pool_mgr->gap_nodes[base], sizeof(uint32_t) * chunks[c].len);
+			chunks[c - 1].len += chunks[c].len;
+			_mem_gap_ix_drop_chunk(pool_mgr, c);
+		}
+		else if (c + 1 < pool_mgr->gap_num_chunks && chunks[c].len + chunks[c + 1].len <= chunk_size / 2) {
+			unsigned next = chunks[c + 1].chunk * chunk_size;
+			memcpy(&pool_mgr->gap_sizes[base + chunks[c].len], &pool_mgr->gap_sizes[next], sizeof(uint32_t) * chunks[c + 1].len);
+			memcpy(&pool_mgr->gap_nodes[base + chunks[c].len], &pool_mgr->gap_nodes[next], sizeof(uint32_t) * chunks[c + 1].len);
+			chunks[c].len += chunks[c + 1].len;
+			_mem_gap_ix_drop_chunk(pool_mgr, c + 1);
+		}
+
+		return ALLOC_OK;
+
+	}
+
+
+	_mem_fail(MEM_ERR_CORRUPT, "_mem_remove_from_gap_ix(): Could not remove gap from gap index.", pool_mgr, size);
+	return ALLOC_FAIL;
+
+}
+
+// the first entry at or after (size, node) in the gap index: chunk c in index order, entry i in it
+// note: c is gap_num_chunks if there's none; ties on size are broken by node, so every gap has a spot of its own
+static unsigned _mem_gap_ix_find(pool_mgr_pt pool_mgr, size_t size, uint32_t node, unsigned *i) {
+
+	const uint32_t *sizes = pool_mgr->gap_sizes;
+	const uint32_t *nodes = pool_mgr->gap_nodes;
+	const gap_chunk_t *chunks = pool_mgr->gap_chunks;
+	unsigned chunk_size = pool_mgr->gap_chunk_size;
+	unsigned lo = 0, hi = pool_mgr->gap_num_chunks;
+
+	// the first chunk whose last entry is at or after it
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		unsigned last = chunks[mid].chunk * chunk_size + chunks[mid].len - 1;
+		if (sizes[last] < size || (sizes[last] == size && nodes[last] < node))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*i = 0;
+	if (lo == pool_mgr->gap_num_chunks)
+		return lo;
+
+	// then the entry in it
+	unsigned c = lo, base = chunks[c].chunk * chunk_size;
+	lo = 0;
+	hi = chunks[c].len;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (sizes[base + mid] < size || (sizes[base + mid] == size && nodes[base + mid] < node))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*i = lo;
+	return c;
+
+}
+
+// an empty chunk, or one that was merged into its neighbour, goes to the empty ones past the end
+static void _mem_gap_ix_drop_chunk(pool_mgr_pt pool_mgr, unsigned c) {
+
+	gap_chunk_t dropped = pool_mgr->gap_chunks[c];
+
+	memmove(&pool_mgr->gap_chunks[c], &pool_mgr->gap_chunks[c + 1], sizeof(gap_chunk_t) * (pool_mgr->gap_num_chunks - c - 1));
+	pool_mgr->gap_num_chunks--;
+
+	dropped.len = 0;
+	pool_mgr->gap_chunks[pool_mgr->gap_num_chunks] = dropped;
+
+}
+
+// gaps smaller than size
+static unsigned _mem_gap_ix_rank(pool_mgr_pt pool_mgr, size_t size) {
+
+	unsigned i;
+	unsigned c = _mem_gap_ix_find(pool_mgr, size, 0, &i);
+
+	for (unsigned j = 0; j < c; j++)
+		i += pool_mgr->gap_chunks[j].len;
+
+	return i;
+
+}
+
+// the last entry, 0 if there are no gaps
+static uint32_t _mem_gap_ix_largest(pool_mgr_pt pool_mgr) {
+
+	if (!pool_mgr->gap_num_chunks)
+		return 0;
+
+	gap_chunk_pt last = &pool_mgr->gap_chunks[pool_mgr->gap_num_chunks - 1];
+	return pool_mgr->gap_sizes[last->chunk * pool_mgr->gap_chunk_size + last->len - 1];
+
+}
+
+
+static uint32_t _mem_find_unused_node(pool_mgr_pt pool_mgr) {
+
+	//   find an unused one in the node heap
+	for (unsigned i = pool_mgr->unused_hint; i < pool_mgr->total_nodes; i++) {
+		if (!pool_mgr->node_sizes[i]) {
+			pool_mgr->unused_hint = i;
+			return i;
+		}
+	}
+
+	return MEM_NIL;
+
+}
+
+// take a merged-away node out of the list and make it available again
+static void _mem_release_node(pool_mgr_pt pool_mgr, uint32_t node) {
+
+	pool_mgr->node_sizes[node] = 0;
+	pool_mgr->node_heap[node].next = MEM_NIL;
+	pool_mgr->node_heap[node].prev = MEM_NIL;
+
+	if (node < pool_mgr->unused_hint)
+		pool_mgr->unused_hint = node;
+
+	//   update metadata (used nodes)
+	pool_mgr->used_nodes--;
+
+}
+
+// a node goes when the frame is released: it's a gap, or an allocation made since the mark
+static int _mem_released_by(pool_mgr_pt pool_mgr, uint32_t node, pool_mark_t mark) {
+
+	uint32_t size = pool_mgr->node_sizes[node];
+
+	if (!(size & MEM_SEG_ALLOCATED))
+		return 1;
+
+	return pool_mgr->alloc_order[node].seq >= mark;
+
+}
+
+// free the newest allocation's whole neighbourhood of released nodes as one gap, until none is left
+// note: a frame carved from one gap comes back in a single pass, with one gap index removal and insert
+static alloc_status _mem_release_to(pool_mgr_pt pool_mgr, pool_mark_t mark) {
+
+	node_pt heap = pool_mgr->node_heap;
+
+	// quick blocks have no record to tell how old they are, they're merged first
+	if (_mem_flush_quick(pool_mgr) == ALLOC_FAIL)
+		return ALLOC_FAIL;
+
+	// no order, nothing was allocated since the mark
+	while (pool_mgr->alloc_order && pool_mgr->newest_alloc != MEM_NIL
+		&& pool_mgr->alloc_order[pool_mgr->newest_alloc].seq >= mark) {
+
+		// widen to the run of released nodes around the newest allocation
+		uint32_t first = pool_mgr->newest_alloc;
+		uint32_t last = first;
+
+		while (heap[first].prev != MEM_NIL && _mem_released_by(pool_mgr, heap[first].prev, mark))
+			first = heap[first].prev;
+		while (heap[last].next != MEM_NIL && _mem_released_by(pool_mgr, heap[last].next, mark))
+			last = heap[last].next;
+
+		// fold the run into its first node
+		uint32_t after = heap[last].next;
+		size_t size = 0;
+		size_t clean = 0; // known-zero tail of the last node, if it's a gap
+
+		for (uint32_t n = first; n != after; ) {
+
+			uint32_t next = heap[n].next;
+			uint32_t n_size = pool_mgr->node_sizes[n];
+
+			if (n_size & MEM_SEG_ALLOCATED) {
+				_mem_drop_alloc_rec(pool_mgr, &pool_mgr->alloc_recs[heap[n].aux]);
+				n_size &= MEM_SEG_SIZE_MASK;
+				clean = 0;
+			}
+			else if (_mem_remove_from_gap_ix(pool_mgr, n_size, n) == ALLOC_FAIL)
+				return ALLOC_FAIL;
+			else
+				clean = n_size - heap[n].aux;
+
+			size += n_size;
+			if (n != first)
+				_mem_release_node(pool_mgr, n);
+
+			n = next;
+
+		}
+
+		heap[first].next = after;
+		if (after != MEM_NIL)
+			heap[after].prev = first;
+
+		// convert to gap node
+		pool_mgr->node_sizes[first] = (uint32_t)size;
+		heap[first].aux = (uint32_t)(size - clean);
+
+		if (_mem_add_to_gap_ix(pool_mgr, size, first) == ALLOC_FAIL)
+			return ALLOC_FAIL;
+
+		_mem_wake_waiter(pool_mgr, size);
+
+	}
+
+	// with no quick blocks, every free run is one gap
+	pool_mgr->pool.num_gaps = pool_mgr->gap_ix_size;
+
+	return ALLOC_OK;
+
+}
+
+// a free record, the one freed last if there is one; there always is, records are as many as nodes
+static uint32_t _mem_new_alloc_rec(pool_mgr_pt pool_mgr) {
+
+	uint32_t rec = pool_mgr->rec_free;
+
+	if (rec == MEM_NIL)
+		return pool_mgr->recs_used++;
+
+	pool_mgr->rec_free = pool_mgr->alloc_recs[rec].node;
+
+	return rec;
+
+}
+
+// everything that goes with an allocation, except its node; the record goes back too
+// note: the rec must be in the current array, alloc_pt's into the old ones are looked up first
+static void _mem_drop_alloc_rec(pool_mgr_pt pool_mgr, alloc_rec_pt rec) {
+
+	pool_pt pool = &pool_mgr->pool;
+	uint32_t node = rec->node;
+	size_t size = rec->alloc.size;
+	unsigned tag = pool_mgr->alloc_tags ? pool_mgr->alloc_tags[node] : 0;
+
+	// update metadata (num_allocs, alloc_size)
+	pool->num_allocs--;
+	pool->alloc_size -= size;
+	pool_mgr->maint_ops++;
+	pool_mgr->maint_dirty = 1;
+
+	pool_mgr->tags[tag].live_bytes -= size;
+	pool_mgr->tags[tag].live_count--;
+
+	// out of the allocation order, if it was ever in it
+	alloc_order_pt order = pool_mgr->alloc_order;
+	if (order && order[node].seq >= pool_mgr->order_since) {
+		if (order[node].newer != MEM_NIL)
+			order[order[node].newer].older = order[node].older;
+		else
+			pool_mgr->newest_alloc = order[node].older;
+		if (order[node].older != MEM_NIL)
+			order[order[node].older].newer = order[node].newer;
+	}
+
+	_mem_remove_from_addr_ix(pool_mgr, node);
+
+	rec->alloc.mem = NULL;
+	rec->alloc.size = 0;
+	rec->node = pool_mgr->rec_free;
+	pool_mgr->rec_free = (uint32_t)(rec - pool_mgr->alloc_recs);
+
+}
+
+// the alloc_pt is normally one of our records; if it's a copy, look it up by address
+// note: a record of ours is only an allocation while it's taken, quick blocks have none
+static alloc_rec_pt _mem_find_alloc_rec(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+
+	alloc_rec_pt rec = (alloc_rec_pt)alloc;
+
+	if (rec >= pool_mgr->alloc_recs && rec < pool_mgr->alloc_recs + pool_mgr->recs_used)
+		return rec->alloc.mem ? rec : NULL;
+
+	if (!alloc || !alloc->mem)
+		return NULL;
+
+	uint32_t node = _mem_addr_ix_find(pool_mgr, alloc->mem);
+
+	return node == MEM_NIL ? NULL : &pool_mgr->alloc_recs[pool_mgr->node_heap[node].aux];
+
+}
+
+static alloc_status _mem_resize_addr_ix(pool_mgr_pt pool_mgr, float fill_factor) {
+
+	// one more allocation must still be within the fill factor
+	if (((float)(pool_mgr->pool.num_allocs + 1) / (float)(pool_mgr->addr_ix_capacity)) <= fill_factor)
+		return ALLOC_OK;
+
+	unsigned new_capacity = pool_mgr->addr_ix_capacity * MEM_ADDR_IX_EXPAND_FACTOR;
+	uint32_t *new_ix = malloc(sizeof(uint32_t) * new_capacity);
+
+	if (new_ix == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_addr_ix(): Could not resize address index.  malloc() failed.", pool_mgr, 0);
+		return ALLOC_FAIL;
+	}
+
+	for (unsigned i = 0; i < new_capacity; i++)
+		new_ix[i] = MEM_NIL;
+
+	// rehash every allocation into the new table
+	uint32_t *old_ix = pool_mgr->addr_ix;
+	unsigned old_capacity = pool_mgr->addr_ix_capacity;
+
+	pool_mgr->addr_ix = new_ix;
+	pool_mgr->addr_ix_capacity = new_capacity;
+	pool_mgr->addr_ix_shift = 32 - __builtin_ctz(new_capacity);
+
+	for (unsigned i = 0; i < old_capacity; i++) {
+		if (old_ix[i] != MEM_NIL)
+			_mem_add_to_addr_ix(pool_mgr, old_ix[i]);
+	}
+
+	_mem_free_array(pool_mgr, old_ix);
+
+	return ALLOC_OK;
+
+}
+
+// fibonacci hash of the allocation's offset
+static unsigned _mem_addr_ix_slot(pool_mgr_pt pool_mgr, uint32_t offset) {
+
+	return (uint32_t)(offset * 0x9E3779B1u) >> pool_mgr->addr_ix_shift;
+
+}
+
+// note: there is always room, _mem_resize_addr_ix() is called before the allocation
+static void _mem_add_to_addr_ix(pool_mgr_pt pool_mgr, uint32_t node) {
+
+	unsigned mask = pool_mgr->addr_ix_capacity - 1;
+	unsigned i = _mem_addr_ix_slot(pool_mgr, pool_mgr->node_heap[node].offset);
+
+	while (pool_mgr->addr_ix[i] != MEM_NIL)
+		i = (i + 1) & mask;
+
+	pool_mgr->addr_ix[i] = node;
+
+}
+
+static void _mem_remove_from_addr_ix(pool_mgr_pt pool_mgr, uint32_t node) {
+
+	unsigned mask = pool_mgr->addr_ix_capacity - 1;
+	unsigned i = _mem_addr_ix_slot(pool_mgr, pool_mgr->node_heap[node].offset);
+
+	while (pool_mgr->addr_ix[i] != node) {
+		if (pool_mgr->addr_ix[i] == MEM_NIL)
+			return;
+		i = (i + 1) & mask;
+	}
+
+	// backward-shift deletion: pull up later entries that would otherwise be cut off
+	for (unsigned j = (i + 1) & mask; pool_mgr->addr_ix[j] != MEM_NIL; j = (j + 1) & mask) {
+		unsigned home = _mem_addr_ix_slot(pool_mgr, pool_mgr->node_heap[pool_mgr->addr_ix[j]].offset);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			pool_mgr->addr_ix[i] = pool_mgr->addr_ix[j];
+			i = j;
+		}
+	}
+
+	pool_mgr->addr_ix[i] = MEM_NIL;
+
+}
+
+// note: an address outside the pool could wrap around to an offset inside it, so it's never found
+static uint32_t _mem_addr_ix_find(pool_mgr_pt pool_mgr, const char *mem) {
+
+	unsigned mask = pool_mgr->addr_ix_capacity - 1;
+
+	if (mem < pool_mgr->pool.mem || mem >= pool_mgr->pool.mem + pool_mgr->pool.total_size)
+		return MEM_NIL;
+
+	uint32_t offset = (uint32_t)(mem - pool_mgr->pool.mem);
+
+	for (unsigned i = _mem_addr_ix_slot(pool_mgr, offset); pool_mgr->addr_ix[i] != MEM_NIL; i = (i + 1) & mask) {
+		if (pool_mgr->node_heap[pool_mgr->addr_ix[i]].offset == offset)
+			return pool_mgr->addr_ix[i];
+	}
+
+	return MEM_NIL;
+
+}
+
+// the pool memory is mapped in whole pages
+static size_t _mem_pool_bytes(size_t size) {
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	return (size + page - 1) / page * page;
+
+}
+
+// point every page of [mem, mem + bytes) at the pool (or at NULL, to clear)
+// note: interior levels are never freed, they are small and pools come and go
+static alloc_status _mem_page_map_set(const char *mem, size_t bytes, pool_mgr_pt pool_mgr) {
+
+	uintptr_t first = (uintptr_t)mem >> MEM_PAGE_MAP_SHIFT;
+	uintptr_t last = ((uintptr_t)mem + bytes - 1) >> MEM_PAGE_MAP_SHIFT;
+
+	if (last >> (3 * MEM_PAGE_MAP_LEVEL_BITS))
+		return ALLOC_FAIL;
+
+	for (uintptr_t page = first; page <= last; page++) {
+
+		pool_mgr_pt **mid = page_map[page >> (2 * MEM_PAGE_MAP_LEVEL_BITS)];
+		if (!mid) {
+			if (!pool_mgr)
+				continue;
+			mid = calloc((size_t)1 << MEM_PAGE_MAP_LEVEL_BITS, sizeof(pool_mgr_pt *));
+			if (!mid)
+				return ALLOC_FAIL;
+			page_map[page >> (2 * MEM_PAGE_MAP_LEVEL_BITS)] = mid;
+		}
+
+		pool_mgr_pt *leaf = mid[(page >> MEM_PAGE_MAP_LEVEL_BITS) & MEM_PAGE_MAP_LEVEL_MASK];
+		if (!leaf) {
+			if (!pool_mgr)
+				continue;
+			leaf = calloc((size_t)1 << MEM_PAGE_MAP_LEVEL_BITS, sizeof(pool_mgr_pt));
+			if (!leaf)
+				return ALLOC_FAIL;
+			mid[(page >> MEM_PAGE_MAP_LEVEL_BITS) & MEM_PAGE_MAP_LEVEL_MASK] = leaf;
+		}
+
+		leaf[page & MEM_PAGE_MAP_LEVEL_MASK] = pool_mgr;
+
+	}
+
+	return ALLOC_OK;
+
+}
+
+static pool_mgr_pt _mem_page_map_get(const void *ptr) {
+
+	uintptr_t page = (uintptr_t)ptr >> MEM_PAGE_MAP_SHIFT;
+
+	if (page >> (3 * MEM_PAGE_MAP_LEVEL_BITS))
+		return NULL;
+
+	pool_mgr_pt **mid = page_map[page >> (2 * MEM_PAGE_MAP_LEVEL_BITS)];
+	if (!mid)
+		return NULL;
+
+	pool_mgr_pt *leaf = mid[(page >> MEM_PAGE_MAP_LEVEL_BITS) & MEM_PAGE_MAP_LEVEL_MASK];
+	if (!leaf)
+		return NULL;
+
+	return leaf[page & MEM_PAGE_MAP_LEVEL_MASK];
+
+}
+
+// map the clone's memory as another private view of the pool's memfd
+// note: the file has to hold the pool as it is now. A mem_pool_open_cow() pool's shared view is the
+// file, so the first clone just turns it private; any other pool is written into a new file then
+// (O(live data), once). After that, the file is frozen, so pages either side writes are its own and
+// the pool's are copied over to each later clone
+static alloc_status _mem_clone_pages(pool_mgr_pt pool_mgr, pool_mgr_pt clone) {
+
+	size_t bytes = _mem_pool_bytes(pool_mgr->pool.total_size);
+	int fresh = pool_mgr->mem_fd < 0 || pool_mgr->mem_shared;
+
+	if (pool_mgr->mem_fd < 0 && _mem_make_base(pool_mgr) == ALLOC_FAIL)
+		return ALLOC_FAIL;
+
+	// same address and same file, so nothing moves and every pointer into the pool stays good
+	if (pool_mgr->mem_shared) {
+		if (mmap(pool_mgr->pool.mem, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, pool_mgr->mem_fd, 0) == MAP_FAILED)
+			return ALLOC_FAIL;
+		pool_mgr->mem_shared = 0;
+	}
+
+	clone->mem_fd = fcntl(pool_mgr->mem_fd, F_DUPFD_CLOEXEC, 0);
+	if (clone->mem_fd < 0)
+		return ALLOC_FAIL;
+
+	char *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, pool_mgr->mem_fd, 0);
+	if (mem == MAP_FAILED)
+		return ALLOC_FAIL;
+	clone->pool.mem = mem;
+
+	// whatever the pool wrote since the file was frozen is only in its own pages
+	if (!fresh)
+		_mem_copy_dirty_pages(pool_mgr, mem);
+
+	return ALLOC_OK;
+
+}
+
+// the metadata is copied outright, it's what the clone costs
+static alloc_status _mem_clone_metadata(pool_mgr_pt pool_mgr, pool_mgr_pt clone) {
+
+	size_t reserved_nodes = pool_mgr->reserved_nodes;
+
+	clone->node_sizes = _mem_reserve(sizeof(uint32_t) * reserved_nodes);
+	clone->node_heap = _mem_reserve(sizeof(node_t) * reserved_nodes);
+	rec_block_pt rec_block = _mem_reserve(_mem_rec_block_bytes(reserved_nodes));
+	clone->gap_sizes = malloc(sizeof(uint32_t) * pool_mgr->gap_ix_capacity);
+	clone->gap_nodes = malloc(sizeof(uint32_t) * pool_mgr->gap_ix_capacity);
+	clone->gap_chunks = malloc(sizeof(gap_chunk_t) * (pool_mgr->gap_ix_capacity / pool_mgr->gap_chunk_size));
+	clone->addr_ix = malloc(sizeof(uint32_t) * pool_mgr->addr_ix_capacity);
+	clone->tags = malloc(sizeof(tag_rec_t) * pool_mgr->tags_capacity);
+	if (pool_mgr->alloc_tags)
+		clone->alloc_tags = malloc(sizeof(uint32_t) * pool_mgr->total_nodes);
+	if (pool_mgr->alloc_order)
+		clone->alloc_order = malloc(sizeof(alloc_order_t) * pool_mgr->total_nodes);
+	if (pool_mgr->adapt)
+		clone->adapt = malloc(sizeof(adapt_t));
+	if (pool_mgr->quick)
+		clone->quick = _mem_new_quick();
+
+	if (!clone->node_sizes || !clone->node_heap || !rec_block
+		|| !clone->gap_sizes || !clone->gap_nodes || !clone->gap_chunks || !clone->addr_ix || !clone->tags
+		|| (pool_mgr->alloc_tags && !clone->alloc_tags) || (pool_mgr->alloc_order && !clone->alloc_order)
+		|| (pool_mgr->adapt && !clone->adapt) || (pool_mgr->quick && !clone->quick)
+		|| _mem_commit(clone->node_sizes, sizeof(uint32_t) * pool_mgr->total_nodes) == ALLOC_FAIL
+		|| _mem_commit(clone->node_heap, sizeof(node_t) * pool_mgr->total_nodes) == ALLOC_FAIL
+		|| _mem_commit(rec_block, _mem_rec_block_bytes(pool_mgr->total_nodes)) == ALLOC_FAIL) {
+		_mem_unreserve(rec_block, _mem_rec_block_bytes(reserved_nodes));
+		return ALLOC_FAIL;
+	}
+
+	rec_block->prev = NULL;
+	rec_block->bytes = _mem_rec_block_bytes(reserved_nodes);
+	clone->rec_block = rec_block;
+	clone->alloc_recs = rec_block->recs;
+
+	memcpy(clone->node_sizes, pool_mgr->node_sizes, sizeof(uint32_t) * pool_mgr->total_nodes);
+	memcpy(clone->node_heap, pool_mgr->node_heap, sizeof(node_t) * pool_mgr->total_nodes);
+	memcpy(clone->alloc_recs, pool_mgr->alloc_recs, sizeof(alloc_rec_t) * pool_mgr->recs_used);
+	if (pool_mgr->alloc_tags)
+		memcpy(clone->alloc_tags, pool_mgr->alloc_tags, sizeof(uint32_t) * pool_mgr->total_nodes);
+	if (pool_mgr->alloc_order)
+		memcpy(clone->alloc_order, pool_mgr->alloc_order, sizeof(alloc_order_t) * pool_mgr->total_nodes);
+	memcpy(clone->gap_sizes, pool_mgr->gap_sizes, sizeof(uint32_t) * pool_mgr->gap_ix_capacity);
+	memcpy(clone->gap_nodes, pool_mgr->gap_nodes, sizeof(uint32_t) * pool_mgr->gap_ix_capacity);
+	memcpy(clone->gap_chunks, pool_mgr->gap_chunks, sizeof(gap_chunk_t) * (pool_mgr->gap_ix_capacity / pool_mgr->gap_chunk_size));
+	memcpy(clone->addr_ix, pool_mgr->addr_ix, sizeof(uint32_t) * pool_mgr->addr_ix_capacity);
+	memcpy(clone->tags, pool_mgr->tags, sizeof(tag_rec_t) * pool_mgr->tags_capacity);
+	if (pool_mgr->adapt)
+		*clone->adapt = *pool_mgr->adapt;
+
+	// records point into the pool's memory, move them over to the clone's
+	// note: the nodes and the address index are by offset, so they carry over as is
+	for (unsigned i = 0; i < clone->recs_used; i++) {
+		if (clone->alloc_recs[i].alloc.mem)
+			clone->alloc_recs[i].alloc.mem = clone->pool.mem + (clone->alloc_recs[i].alloc.mem - pool_mgr->pool.mem);
+	}
+
+	return ALLOC_OK;
+
+}
+
+// move the pool's memory into a memfd and map it back in place as a private view of the file
+// note: only the allocations are written, gaps are left as holes in the file
+static alloc_status _mem_make_base(pool_mgr_pt pool_mgr) {
+
+	size_t bytes = _mem_pool_bytes(pool_mgr->pool.total_size);
+
+	int fd = memfd_create("mem_pool", MFD_CLOEXEC);
+	if (fd < 0)
+		return ALLOC_FAIL;
+
+	if (ftruncate(fd, (off_t)bytes)) {
+		close(fd);
+		return ALLOC_FAIL;
+	}
+
+	for (uint32_t n = 0; n != MEM_NIL; n = pool_mgr->node_heap[n].next) {
+
+		if (!(pool_mgr->node_sizes[n] & MEM_SEG_ALLOCATED))
+			continue;
+
+		size_t offset = pool_mgr->node_heap[n].offset;
+		size_t size = pool_mgr->node_sizes[n] & MEM_SEG_SIZE_MASK;
+
+		while (size) {
+			ssize_t written = pwrite(fd, pool_mgr->pool.mem + offset, size, (off_t)offset);
+			if (written <= 0) {
+				close(fd);
+				return ALLOC_FAIL;
+			}
+			offset += (size_t)written;
+			size -= (size_t)written;
+		}
+
+	}
+
+	// same address, so every pointer into the pool stays good
+	if (mmap(pool_mgr->pool.mem, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		close(fd);
+		return ALLOC_FAIL;
+	}
+
+	pool_mgr->mem_fd = fd;
+
+	return ALLOC_OK;
+
+}
+
+// copy the pages under the pool's allocations that it has written to since its file was frozen,
+// dst sees the rest through the file already
+// note: gaps are left out, their dirty counts already cover whatever the pool wrote there. Written
+// pages are the anonymous ones in /proc/self/pagemap; if it can't be read, the allocations are copied whole
+static void _mem_copy_dirty_pages(pool_mgr_pt pool_mgr, char *dst) {
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const char *src = pool_mgr->pool.mem;
+	int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+	// runs of pages under neighbouring allocations, flushed when the next one doesn't touch them
+	size_t run_first = 0, run_end = 0;
+
+	for (uint32_t n = 0; ; n = pool_mgr->node_heap[n].next) {
+
+		size_t first = run_end, end = run_end;
+
+		if (n != MEM_NIL) {
+			if (!(pool_mgr->node_sizes[n] & MEM_SEG_ALLOCATED))
+				continue;
+			size_t offset = pool_mgr->node_heap[n].offset;
+			first = offset / page;
+			end = (offset + (pool_mgr->node_sizes[n] & MEM_SEG_SIZE_MASK) + page - 1) / page;
+			if (first <= run_end && run_end > run_first) {
+				run_end = end;
+				continue;
+			}
+		}
+
+		if (run_end > run_first)
+			_mem_copy_dirty_run(fd, src, dst, page, run_first, run_end);
 
-				for (int j = i; j < pool_mgr->pool.num_gaps; j++) {
-					//pool_mgr->gap_ix[j] = pool_mgr->gap_ix[j + 1];
-					pool_mgr->gap_ix[j].node = pool_mgr->gap_ix[j + 1].node;
-					pool_mgr->gap_ix[j].size = pool_mgr->gap_ix[j + 1].size;
-				}
+		if (n == MEM_NIL)
+			break;
+
+		run_first = first;
+		run_end = end;
 
-				pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = NULL;
-				pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = 0;
+	}
 
-				// decrease gap count
-				pool_mgr->pool.num_gaps--;
+	if (fd >= 0)
+		close(fd);
 
-			}
+}
 
+// copy the written pages in [first, end) of src, or all of them if fd isn't the pagemap
+static void _mem_copy_dirty_run(int fd, const char *src, char *dst, size_t page, size_t first, size_t end) {
 
-			return ALLOC_OK;
+	uint64_t entries[512];
+
+	for (; first < end; first += 512) {
+
+		size_t n = end - first < 512 ? end - first : 512;
+		off_t at = (off_t)(((uintptr_t)src / page + first) * sizeof(uint64_t));
 
+		if (fd < 0 || pread(fd, entries, n * sizeof(uint64_t), at) != (ssize_t)(n * sizeof(uint64_t))) {
+			memcpy(dst + first * page, src + first * page, (end - first) * page);
+			return;
+		}
+
+		// bit 63 is present, 62 swapped, 61 file page: a private copy is present and not a file page, or swapped
+		for (size_t i = 0; i < n; i++) {
+			uint64_t e = entries[i];
+			if (((e >> 63) & 1 && !((e >> 61) & 1)) || (e >> 62) & 1)
+				memcpy(dst + (first + i) * page, src + (first + i) * page, page);
 		}
 
 	}
 
+}
 
-	puts("Could not remove gap from gap index.");
-	return ALLOC_FAIL;
+// make sure there are stats for the tag
+static alloc_status _mem_resize_tags(pool_mgr_pt pool_mgr, unsigned tag) {
+
+	if (tag < pool_mgr->tags_capacity)
+		return ALLOC_OK;
+
+	unsigned new_capacity = pool_mgr->tags_capacity * MEM_TAG_EXPAND_FACTOR;
+	if (new_capacity <= tag)
+		new_capacity = tag + 1;
+
+	tag_rec_pt new_tags = _mem_realloc_array(pool_mgr, pool_mgr->tags,
+		sizeof(tag_rec_t) * pool_mgr->tags_capacity, sizeof(tag_rec_t) * new_capacity);
+
+	if (new_tags == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "_mem_resize_tags(): Could not resize tag stats.  realloc() failed.", pool_mgr, tag);
+		return ALLOC_FAIL;
+	}
+
+	memset(&new_tags[pool_mgr->tags_capacity], 0, sizeof(tag_rec_t) * (new_capacity - pool_mgr->tags_capacity));
+
+	pool_mgr->tags = new_tags;
+	pool_mgr->tags_capacity = new_capacity;
+
+	return ALLOC_OK;
 
 }
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
-	// the new entry is at the end, so "bubble it up"
-	// loop from num_gaps - 1 until but not including 0:
-	//    if the size of the current entry is less than the previous (u - 1)
-	//       swap them (by copying) (remember to use a temporary variable)
+// the rate is allocations per second since the last dump (or the pool was opened)
+static void _mem_tag_stats(pool_mgr_pt pool_mgr, unsigned tag, double now, tag_stats_pt stats) {
 
-	gap_pt gap_ix = pool_mgr->gap_ix;
-	for (int i = pool_mgr->pool.num_gaps - 1; i > 0; i--) {
+	tag_rec_pt tag_rec = &pool_mgr->tags[tag];
+	double window = now - pool_mgr->tags_since;
 
-		if (gap_ix[i].size < gap_ix[i - 1].size) {
+	stats->tag = tag;
+	stats->live_bytes = tag_rec->live_bytes;
+	stats->live_count = tag_rec->live_count;
+	stats->peak_bytes = tag_rec->peak_bytes;
+	stats->allocs = tag_rec->allocs;
+	stats->alloc_rate = window > 0 ? (double)(tag_rec->allocs - tag_rec->allocs_at_dump) / window : 0;
 
-			// we found one that's out of order, bubble it down until it's in the correct position
-			for (int j = i; j > 0; j--) {
+}
 
-				if (gap_ix[j].size < gap_ix[j - 1].size) {
-					gap_t temp = gap_ix[j];
-					gap_ix[j] = gap_ix[j - 1];
-					gap_ix[j - 1] = temp;
-				}
-				else
-					break;
+// biggest live bytes first, then by tag so the order is stable
+static int _mem_tag_stats_cmp(const void *a, const void *b) {
 
-			}
+	const tag_stats_t *x = a, *y = b;
 
-		}
-		else
-			break;
-	
+	if (x->live_bytes != y->live_bytes)
+		return x->live_bytes < y->live_bytes ? 1 : -1;
+
+	return x->tag < y->tag ? -1 : x->tag > y->tag;
+
+}
+
+// seconds, for the tag rates
+static double _mem_now() {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+
+}
+
+// note: the lock only exists once the pool is shared, by mem_pool_share() or a maintenance worker
+static void _mem_lock(pool_mgr_pt pool_mgr) {
+
+	if (pool_mgr->sync)
+		pthread_mutex_lock(&pool_mgr->sync->lock);
+
+}
+
+// wakes the worker on the way out if something is past its fill factor
+static void _mem_unlock(pool_mgr_pt pool_mgr) {
+
+	if (!pool_mgr->sync)
+		return;
+
+	if (pool_mgr->maint && _mem_maint_needed(pool_mgr))
+		pthread_cond_signal(&pool_mgr->maint->wake);
+
+	pthread_mutex_unlock(&pool_mgr->sync->lock);
+
+}
+
+static alloc_status _mem_share(pool_mgr_pt pool_mgr) {
+
+	sync_pt sync = malloc(sizeof(sync_t));
+
+	if (sync == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_share(): Could not allocate lock.", pool_mgr, 0);
+		return ALLOC_FAIL;
+	}
+
+	if (pthread_mutex_init(&sync->lock, NULL)) {
+		_mem_fail(MEM_ERR_SYSTEM, "mem_pool_share(): Could not create lock.", pool_mgr, 0);
+		free(sync);
+		return ALLOC_FAIL;
 	}
 
+	sync->wait_head = NULL;
+	sync->wait_tail = NULL;
+	pool_mgr->sync = sync;
+
 	return ALLOC_OK;
 
 }
 
+// the gap index is sorted, so there's a gap of size exactly when the last one is big enough
+static int _mem_fits(pool_mgr_pt pool_mgr, size_t size) {
 
-static node_pt _mem_find_unused_node(pool_mgr_pt pool_mgr) {
+	return _mem_gap_ix_largest(pool_mgr) >= size;
+
+}
+
+// a gap of gap_size just came about, wake the first waiter if it fits
+// note: only the first, the others wait their turn even if they'd fit, so big requests don't starve
+static void _mem_wake_waiter(pool_mgr_pt pool_mgr, size_t gap_size) {
+
+	waiter_pt waiter = pool_mgr->sync ? pool_mgr->sync->wait_head : NULL;
+
+	if (waiter && waiter->size <= gap_size)
+		pthread_cond_signal(&waiter->wake);
+
+}
+
+// note: the node heap stops counting once it reaches max_nodes
+static int _mem_maint_needed(pool_mgr_pt pool_mgr) {
+
+	return ((float)pool_mgr->used_nodes / (float)pool_mgr->total_nodes > MEM_MAINT_FILL_FACTOR
+			&& pool_mgr->total_nodes < pool_mgr->max_nodes)
+		|| _mem_gap_ix_full(pool_mgr, MEM_MAINT_FILL_FACTOR)
+		|| (float)(pool_mgr->pool.num_allocs + 1) / (float)pool_mgr->addr_ix_capacity > MEM_MAINT_FILL_FACTOR;
+
+}
+
+// grows everything ahead of the callers, and trims when the pool has been left alone for a period
+// note: failures are ignored, the callers still grow things themselves at the usual fill factors
+static void *_mem_maint_worker(void *arg) {
+
+	pool_mgr_pt pool_mgr = (pool_mgr_pt)arg;
+
+	pthread_mutex_lock(&pool_mgr->sync->lock);
+
+	unsigned long last_ops = pool_mgr->maint_ops;
+
+	while (!pool_mgr->maint->stop) {
+
+		_mem_resize_node_heap(pool_mgr, MEM_MAINT_FILL_FACTOR);
+		_mem_resize_gap_ix(pool_mgr, MEM_MAINT_FILL_FACTOR);
+		_mem_resize_addr_ix(pool_mgr, MEM_MAINT_FILL_FACTOR);
+
+		if (pool_mgr->maint_ops == last_ops && pool_mgr->maint_dirty) {
+			_mem_maint_trim(pool_mgr);
+			pool_mgr->maint_dirty = 0;
+		}
+		last_ops = pool_mgr->maint_ops;
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += MEM_MAINT_PERIOD_MS * 1000000;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+
+		pthread_cond_timedwait(&pool_mgr->maint->wake, &pool_mgr->sync->lock, &deadline);
 
-	//   find an unused one in the node heap
-	for (int i = 0; i < pool_mgr->total_nodes; i++) {
-		if (!pool_mgr->node_heap[i].used)
-			return &(pool_mgr->node_heap[i]);
 	}
 
+	pthread_mutex_unlock(&pool_mgr->sync->lock);
+
 	return NULL;
 
-}
\ No newline at end of file
+}
+
+// give the whole pages inside big gaps back to the kernel, they come back as zero pages
+// note: or as the file's contents, once the pool has been cloned; a compact pool's
+// block is malloc()'s memory, not ours to give back, so it's left alone
+static void _mem_maint_trim(pool_mgr_pt pool_mgr) {
+
+	if (pool_mgr->compact)
+		return;
+
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	int zero_pages = _mem_zero_pages(pool_mgr);
+
+	// the gap index is sorted, so the big gaps are all at the end
+	unsigned i;
+	for (unsigned c = _mem_gap_ix_find(pool_mgr, MEM_MAINT_TRIM_MIN, 0, &i); c < pool_mgr->gap_num_chunks; c++, i = 0)
+	for (unsigned base = pool_mgr->gap_chunks[c].chunk * pool_mgr->gap_chunk_size; i < pool_mgr->gap_chunks[c].len; i++) {
+
+		node_pt gap = &pool_mgr->node_heap[pool_mgr->gap_nodes[base + i]];
+		uintptr_t gap_start = (uintptr_t)(pool_mgr->pool.mem + gap->offset);
+		uintptr_t start = (gap_start + page - 1) & ~(page - 1);
+		uintptr_t end = (gap_start + pool_mgr->gap_sizes[base + i]) & ~(page - 1);
+
+		if (end <= start || madvise((void *)start, end - start, pool_mgr->mem_shared ? MADV_REMOVE : MADV_DONTNEED))
+			continue;
+
+		// zero pages reaching the known-zero tail make it longer
+		if (zero_pages && end >= gap_start + gap->aux && start < gap_start + gap->aux)
+			gap->aux = (uint32_t)(start - gap_start);
+
+	}
+
+}
+
+// pages given back to the kernel come back as zero pages: anonymous ones, and a shared view's once
+// they're punched out of the file, but not a private view's, those come back as the file's contents
+static int _mem_zero_pages(pool_mgr_pt pool_mgr) {
+
+	return pool_mgr->mem_fd < 0 || pool_mgr->mem_shared;
+
+}
+
+// clears the front of a new allocation that may not be zero
+// note: a big enough run gives its whole pages back to the kernel, only where they come back as
+// zero pages and only where they're ours to give back (not in a compact pool's block, like _mem_maint_trim())
+static void _mem_zero(pool_mgr_pt pool_mgr, char *mem, size_t bytes) {
+
+	if (bytes >= MEM_ZERO_MADVISE_MIN && _mem_zero_pages(pool_mgr) && !pool_mgr->compact) {
+
+		uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+		uintptr_t start = ((uintptr_t)mem + page - 1) & ~(page - 1);
+		uintptr_t end = ((uintptr_t)mem + bytes) & ~(page - 1);
+
+		if (end > start && !madvise((void *)start, end - start, pool_mgr->mem_shared ? MADV_REMOVE : MADV_DONTNEED)) {
+			memset(mem, 0, start - (uintptr_t)mem);
+			memset((void *)end, 0, (uintptr_t)mem + bytes - end);
+			return;
+		}
+
+	}
+
+	memset(mem, 0, bytes);
+
+}
+
+// reserve address space only; page aligned, so also fine for the vector kernels
+static void *_mem_reserve(size_t bytes) {
+
+	void *base = mmap(NULL, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	return base == MAP_FAILED ? NULL : base;
+
+}
+
+// make the first bytes of a reservation usable (already committed pages are kept)
+static alloc_status _mem_commit(void *base, size_t bytes) {
+
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t len = (bytes + page - 1) / page * page;
+
+	return mprotect(base, len, PROT_READ | PROT_WRITE) ? ALLOC_FAIL : ALLOC_OK;
+
+}
+
+static void _mem_unreserve(void *base, size_t bytes) {
+
+	if (base)
+		munmap(base, bytes);
+
+}
+
+
+
+/**********************/
+/*                    */
+/* Adaptive placement */
+/*                    */
+/**********************/
+static alloc_status _mem_start_adapt(pool_mgr_pt pool_mgr) {
+
+	adapt_pt adapt = calloc(1, sizeof(adapt_t));
+
+	if (adapt == NULL) {
+		_mem_fail(MEM_ERR_NO_MEMORY, "mem_pool_open(): Could not allocate adaptive policy state.", NULL, pool_mgr->pool.total_size);
+		return ALLOC_FAIL;
+	}
+
+	// FIRST_FIT until the samples say otherwise, scans are short while the pool is young
+	adapt->placement = FIRST_FIT;
+	_mem_adapt_reset(adapt);
+	pool_mgr->adapt = adapt;
+
+	return ALLOC_OK;
+
+}
+
+// the end of a window: sum it up, then switch if the numbers call for it
+static void _mem_adapt(pool_mgr_pt pool_mgr) {
+
+	pool_pt pool = &pool_mgr->pool;
+	adapt_pt adapt = pool_mgr->adapt;
+
+	adapt_window_t window;
+	window.allocs = adapt->allocs;
+	window.mean_size = adapt->size_sum / adapt->allocs;
+
+	double variance = adapt->size_sq_sum / adapt->allocs - window.mean_size * window.mean_size;
+	window.size_cv = variance > 0 ? sqrt(variance) / window.mean_size : 0;
+
+	window.scan_len = adapt->scans ? adapt->scan_sum / adapt->scans : 0;
+
+	// the gap index is sorted, so the largest gap is last and the slivers are first
+	size_t free_size = pool->total_size - pool->alloc_size;
+	size_t largest = _mem_gap_ix_largest(pool_mgr);
+	window.fragmentation = free_size ? 1.0 - (double)largest / (double)free_size : 0;
+	window.slivers = pool_mgr->gap_ix_size ? (double)_mem_gap_ix_rank(pool_mgr, adapt->min_size) / pool_mgr->gap_ix_size : 0;
+
+
+	// FIRST_FIT gives up on long scans, or on mixed sizes carving up the free space;
+	// BEST_FIT goes back only when scans would be short and the free space is in one piece
+	alloc_policy to = adapt->placement;
+	adapt_reason reason = ADAPT_LONG_SCANS;
+
+	if (adapt->placement == FIRST_FIT) {
+
+		if (window.scan_len > MEM_ADAPT_SCAN_MAX) {
+			to = BEST_FIT;
+			reason = ADAPT_LONG_SCANS;
+		}
+		else if (window.fragmentation > MEM_ADAPT_FRAG_MAX && window.size_cv > MEM_ADAPT_CV_MIXED) {
+			to = BEST_FIT;
+			reason = ADAPT_FRAGMENTED;
+		}
+
+	}
+	else if (window.scan_len < MEM_ADAPT_SCAN_MAX / 4 && window.fragmentation < MEM_ADAPT_FRAG_MAX / 2) {
+
+		if (window.slivers > MEM_ADAPT_SLIVER_MAX) {
+			to = FIRST_FIT;
+			reason = ADAPT_SLIVERS;
+		}
+		else if (window.size_cv < MEM_ADAPT_CV_UNIFORM) {
+			to = FIRST_FIT;
+			reason = ADAPT_UNIFORM;
+		}
+
+	}
+
+
+	// log the switch, the oldest entry goes
+	if (to != adapt->placement) {
+		adapt_switch_pt entry = &adapt->log[adapt->switches % MEM_ADAPT_LOG];
+		entry->at = pool_mgr->alloc_seq;
+		entry->from = adapt->placement;
+		entry->to = to;
+		entry->reason = reason;
+		entry->window = window;
+
+		adapt->switches++;
+		adapt->placement = to;
+	}
+
+	adapt->windows++;
+	adapt->last = window;
+	_mem_adapt_reset(adapt);
+
+}
+
+static void _mem_adapt_reset(adapt_pt adapt) {
+
+	adapt->allocs = 0;
+	adapt->size_sum = 0;
+	adapt->size_sq_sum = 0;
+	adapt->min_size = SIZE_MAX;
+	adapt->scan_sum = 0;
+	adapt->scans = 0;
+
+}
+
+
+
+/***************/
+/*             */
+/* Quick lists */
+/*             */
+/***************/
+static quick_pt _mem_new_quick() {
+
+	quick_pt quick = malloc(sizeof(quick_t));
+
+	if (quick == NULL)
+		return NULL;
+
+	for (unsigned i = 0; i < MEM_QUICK_SLOTS; i++) {
+		quick->sizes[i] = 0;
+		quick->heads[i] = MEM_NIL;
+	}
+	quick->count = 0;
+
+	return quick;
+
+}
+
+// one slot per size, fibonacci hashed; sizes that collide with a busy slot are just merged as usual
+static unsigned _mem_quick_slot(size_t size) {
+
+	return ((uint32_t)size * 2654435769u) >> (32 - __builtin_ctz(MEM_QUICK_SLOTS));
+
+}
+
+// the newest block of exactly size, left on its list, or MEM_NIL
+static uint32_t _mem_quick_find(pool_mgr_pt pool_mgr, size_t size) {
+
+	quick_pt quick = pool_mgr->quick;
+
+	if (!quick || size > MEM_QUICK_MAX_SIZE)
+		return MEM_NIL;
+
+	unsigned slot = _mem_quick_slot(size);
+
+	return quick->sizes[slot] == size ? quick->heads[slot] : MEM_NIL;
+
+}
+
+// takes the block _mem_quick_find() found off its list, the caller makes it an allocation
+static void _mem_quick_pop(pool_mgr_pt pool_mgr, size_t size) {
+
+	quick_pt quick = pool_mgr->quick;
+	unsigned slot = _mem_quick_slot(size);
+
+	quick->heads[slot] = pool_mgr->node_heap[quick->heads[slot]].aux;
+	quick->count--;
+
+	if (quick->heads[slot] == MEM_NIL)
+		quick->sizes[slot] = 0;
+
+}
+
+// puts a freed node on the list for its size; 0 if the slot holds another size
+static int _mem_quick_push(pool_mgr_pt pool_mgr, uint32_t node, uint32_t size) {
+
+	quick_pt quick = pool_mgr->quick;
+	unsigned slot = _mem_quick_slot(size);
+
+	if (quick->sizes[slot] && quick->sizes[slot] != size)
+		return 0;
+
+	pool_mgr->node_sizes[node] = MEM_SEG_QUICK;
+	pool_mgr->node_heap[node].aux = quick->heads[slot];
+	quick->sizes[slot] = size;
+	quick->heads[slot] = node;
+	quick->count++;
+
+	return 1;
+
+}
+
+// merges every quick block into the gaps, as if it had just been freed
+// note: num_gaps counted them as free all along, so it stays as it is
+static alloc_status _mem_flush_quick(pool_mgr_pt pool_mgr) {
+
+	quick_pt quick = pool_mgr->quick;
+
+	if (!quick || !quick->count)
+		return ALLOC_OK;
+
+	for (unsigned slot = 0; slot < MEM_QUICK_SLOTS; slot++) {
+
+		while (quick->heads[slot] != MEM_NIL) {
+			uint32_t node = quick->heads[slot];
+			quick->heads[slot] = pool_mgr->node_heap[node].aux;
+			quick->count--;
+
+			if (_mem_merge_gap(pool_mgr, node, quick->sizes[slot]) == ALLOC_FAIL)
+				return ALLOC_FAIL;
+		}
+
+		quick->sizes[slot] = 0;
+
+	}
+
+	return ALLOC_OK;
+
+}
+
+// how many of the node's neighbours are free as num_gaps sees it: gaps, or blocks on a quick list
+static unsigned _mem_free_neighbours(pool_mgr_pt pool_mgr, uint32_t node) {
+
+	uint32_t prev = pool_mgr->node_heap[node].prev;
+	uint32_t next = pool_mgr->node_heap[node].next;
+	unsigned count = 0;
+
+	if (prev != MEM_NIL && (pool_mgr->node_sizes[prev] == MEM_SEG_QUICK || !(pool_mgr->node_sizes[prev] & MEM_SEG_ALLOCATED)))
+		count++;
+	if (next != MEM_NIL && (pool_mgr->node_sizes[next] == MEM_SEG_QUICK || !(pool_mgr->node_sizes[next] & MEM_SEG_ALLOCATED)))
+		count++;
+
+	return count;
+
+}
+
+
+
+/******************************/
+/*                            */
+/* Failure reporting (events) */
+/*                            */
+/******************************/
+// set the thread's last error and put an event in the ring, nothing here blocks or allocates
+// note: what is a string literal, only the pointer is kept
+static void _mem_fail(mem_error error, const char *what, pool_mgr_pt pool_mgr, size_t size) {
+
+	mem_last_err = error;
+
+	unsigned long seq = __atomic_fetch_add(&mem_events_head, 1, __ATOMIC_RELAXED);
+	mem_event_slot_pt slot = &mem_events[seq & (MEM_EVENT_RING_CAPACITY - 1)];
+
+	// odd while it's written, so a reader can't take a half-written event for a whole one
+	__atomic_store_n(&slot->state, 2 * seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	double time = _mem_now();
+	pool_pt pool = (pool_pt)pool_mgr;
+	__atomic_store(&slot->event.error, &error, __ATOMIC_RELAXED);
+	__atomic_store(&slot->event.what, &what, __ATOMIC_RELAXED);
+	__atomic_store(&slot->event.pool, &pool, __ATOMIC_RELAXED);
+	__atomic_store(&slot->event.size, &size, __ATOMIC_RELAXED);
+	__atomic_store(&slot->event.time, &time, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&slot->state, 2 * seq + 2, __ATOMIC_RELEASE);
+
+}
+
+
+
+/*******************************/
+/*                             */
+/* Gap search (vector kernels) */
+/*                             */
+/*******************************/
+// MEM_POOL_SIMD=scalar|sse2 in the environment caps the kernel, for benchmarking
+static void _mem_select_fit_kernel() {
+
+	const char *isa = getenv("MEM_POOL_SIMD");
+
+	_mem_find_fit = _mem_find_fit_scalar;
+
+#ifdef _MEM_X86_SIMD
+	__builtin_cpu_init();
+
+	if (isa && !strcmp(isa, "scalar"))
+		return;
+	_mem_find_fit = _mem_find_fit_sse2;
+
+	if (isa && !strcmp(isa, "sse2"))
+		return;
+	if (__builtin_cpu_supports("avx2"))
+		_mem_find_fit = _mem_find_fit_avx2;
+#else
+	(void)isa;
+#endif
+
+}
+
+// sizes >= size is sizes > size - 1 (size is never 0 here), compared signed so
+// that allocations, which have the top bit set, never match
+static size_t _mem_find_fit_scalar(const uint32_t *sizes, size_t count, size_t size) {
+
+	const int32_t key = (int32_t)(size - 1);
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+		if ((int32_t)sizes[i] > key)
+			break;
+	}
+
+	return i;
+
+}
+
+#ifdef _MEM_X86_SIMD
+static size_t _mem_find_fit_sse2(const uint32_t *sizes, size_t count, size_t size) {
+
+	const __m128i key = _mm_set1_epi32((int32_t)(size - 1));
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m128i *v = (const __m128i *)(sizes + i);
+		unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_load_si128(v), key)))
+			| (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_load_si128(v + 1), key))) << 4)
+			| (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_load_si128(v + 2), key))) << 8)
+			| (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_load_si128(v + 3), key))) << 12);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + _mem_find_fit_scalar(sizes + i, count - i, size);
+
+}
+
+__attribute__((target("avx2")))
+static size_t _mem_find_fit_avx2(const uint32_t *sizes, size_t count, size_t size) {
+
+	const __m256i key = _mm256_set1_epi32((int32_t)(size - 1));
+
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		const __m256i *v = (const __m256i *)(sizes + i);
+		unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_load_si256(v), key)))
+			| ((unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_load_si256(v + 1), key))) << 8)
+			| ((unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_load_si256(v + 2), key))) << 16)
+			| ((unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_load_si256(v + 3), key))) << 24);
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + _mem_find_fit_scalar(sizes + i, count - i, size);
+
+}
+#endif
@@ -6,10 +6,24 @@
 #define DENVER_OS_PA_C_MEM_POOL_H
 
 #include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* constants */
+
+/* segment sizes and offsets are kept in 31 bits, so this is the largest pool */
+#define MEM_POOL_MAX_SIZE 0x7FFFFFFF
+
+/* tags index a per-pool stats array, so keep them small */
+#define MEM_POOL_MAX_TAG 0xFFFF
 
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+// ADAPTIVE places with FIRST_FIT or BEST_FIT and switches between them, see mem_pool_adapt_stats()
+typedef enum _alloc_policy { FIRST_FIT, BEST_FIT, ADAPTIVE } alloc_policy;
 
 typedef struct _pool {
     char *mem;
@@ -30,6 +44,50 @@ typedef struct _pool_segment {
     unsigned allocated; // 1-allocation, 0-gap
 } pool_segment_t, *pool_segment_pt;
 
+typedef struct _tag_stats {
+    unsigned tag;
+    size_t live_bytes;
+    unsigned live_count;
+    size_t peak_bytes;
+    unsigned long allocs;   // since the pool was opened
+    double alloc_rate;      // allocations per second since the last mem_pool_dump_tags()
+} tag_stats_t, *tag_stats_pt;
+
+// from mem_pool_mark(), see mem_pool_release_to()
+typedef unsigned long long pool_mark_t;
+
+// why an ADAPTIVE pool switched, see mem_pool_adapt_switches()
+typedef enum _adapt_reason {
+    ADAPT_LONG_SCANS,       // FIRST_FIT searches read too many nodes
+    ADAPT_FRAGMENTED,       // mixed sizes were breaking up the free space under FIRST_FIT
+    ADAPT_SLIVERS,          // BEST_FIT was leaving gaps smaller than any request
+    ADAPT_UNIFORM           // sizes settled down, FIRST_FIT keeps them packed low
+} adapt_reason;
+
+// what an ADAPTIVE pool saw over one window of allocations
+typedef struct _adapt_window {
+    unsigned allocs;
+    double mean_size;
+    double size_cv;         // standard deviation of the sizes over their mean
+    double scan_len;        // nodes a FIRST_FIT search reads, measured or sampled
+    double fragmentation;   // free bytes outside the largest gap, over all free bytes
+    double slivers;         // share of gaps smaller than the smallest request
+} adapt_window_t, *adapt_window_pt;
+
+typedef struct _adapt_switch {
+    pool_mark_t at;         // allocations made before it, compares with mem_pool_mark()
+    alloc_policy from, to;
+    adapt_reason reason;
+    adapt_window_t window;  // what it was decided on
+} adapt_switch_t, *adapt_switch_pt;
+
+typedef struct _adapt_stats {
+    alloc_policy placement; // FIRST_FIT or BEST_FIT, what the pool places with right now
+    unsigned long windows;
+    unsigned long switches;
+    adapt_window_t last;    // the most recent window, zero before the first one
+} adapt_stats_t, *adapt_stats_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
@@ -37,6 +95,34 @@ typedef enum _alloc_status {
     ALLOC_NOT_FREED
 } alloc_status;
 
+// why the last call failed, see mem_last_error()
+typedef enum _mem_error {
+    MEM_ERR_NONE,
+    MEM_ERR_CALLED_AGAIN,   // already initialized, already running, ...
+    MEM_ERR_BAD_SIZE,
+    MEM_ERR_BAD_TAG,
+    MEM_ERR_BAD_POLICY,
+    MEM_ERR_BAD_MARK,
+    MEM_ERR_FULL,           // no gaps left at all
+    MEM_ERR_NO_FIT,         // gaps, but none big enough
+    MEM_ERR_NO_MEMORY,      // the metadata or the pool itself could not grow
+    MEM_ERR_NOT_FOUND,      // not an allocation, or not in any pool
+    MEM_ERR_SYSTEM,         // a thread or sync primitive could not be created
+    MEM_ERR_CORRUPT,        // the metadata disagrees with itself
+    MEM_ERR_UNSUPPORTED,    // not for this kind of pool
+    MEM_ERR_TIMEOUT         // mem_new_alloc_wait() gave up
+} mem_error;
+
+// one failure, from mem_drain_events()
+typedef struct _mem_event {
+    unsigned long seq;      // consecutive, a gap means events were overwritten
+    mem_error error;
+    const char *what;       // static message, "function(): ...", the mem_ or _mem_ function that failed
+    pool_pt pool;           // NULL if there was none yet
+    size_t size;            // requested size, where there is one
+    double time;            // seconds, CLOCK_MONOTONIC
+} mem_event_t, *mem_event_pt;
+
 /* function declarations */
 
 alloc_status
@@ -48,16 +134,89 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_cow(size_t size, alloc_policy policy);
+
+pool_pt
+mem_pool_open_compact(size_t size, alloc_policy policy);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+alloc_pt
+mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag);
+
+alloc_pt
+mem_new_alloc_zeroed(pool_pt pool, size_t size);
+
+alloc_pt
+mem_new_alloc_wait(pool_pt pool, size_t size, long timeout_ms);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+pool_pt
+mem_pool_owner(const void *ptr);
+
+alloc_pt
+mem_find_alloc(const void *ptr);
+
+alloc_status
+mem_free_ptr(void *ptr);
+
+alloc_status
+mem_pool_share(pool_pt pool);
+
+alloc_status
+mem_pool_start_maintenance(pool_pt pool);
+
+alloc_status
+mem_pool_stop_maintenance(pool_pt pool);
+
+unsigned
+mem_pool_top_tags(pool_pt pool, tag_stats_pt stats, unsigned max_tags);
+
+void
+mem_pool_dump_tags(pool_pt pool, FILE *out);
+
+pool_pt
+mem_pool_clone(pool_pt pool);
+
+pool_mark_t
+mem_pool_mark(pool_pt pool);
+
+alloc_status
+mem_pool_release_to(pool_pt pool, pool_mark_t mark);
+
+void
+mem_pool_adapt_stats(pool_pt pool, adapt_stats_pt stats);
+
+unsigned
+mem_pool_adapt_switches(pool_pt pool, adapt_switch_pt switches, unsigned max_switches);
+
+alloc_status
+mem_pool_enable_quick_lists(pool_pt pool);
+
+mem_error
+mem_last_error();
+
+const char *
+mem_error_str(mem_error error);
+
+unsigned
+mem_drain_events(mem_event_pt events, unsigned max_events);
+
+void
+mem_dump_events(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
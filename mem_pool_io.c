@@ -0,0 +1,191 @@
+/*
+* Scatter/gather I/O over pool allocations, see mem_pool_io.h.
+*
+* readv() lands the data right in the pool's blocks and writev() takes it
+* from there, the iovecs just point at alloc->mem. With io_uring the pool's
+* memory is registered once, so fixed reads and writes skip pinning pages
+* on every op.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#ifdef MEM_POOL_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "mem_pool.h"
+#include "mem_pool_io.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+
+#define _MEM_IO_MAX_IOV									IOV_MAX
+
+static const size_t     MEM_IO_BUFFER_SIZE = MEM_POOL_IO_BUFFER_SIZE;
+
+
+
+/********************************************/
+/*                                          */
+/* Forward declarations of static functions */
+/*                                          */
+/********************************************/
+
+static void _mem_io_release(pool_pt pool, alloc_pt *blocks, unsigned num_blocks);
+
+
+
+/****************************************/
+/*                                      */
+/* Definitions of user-facing functions */
+/*                                      */
+/****************************************/
+
+ssize_t mem_pool_readv(int fd, pool_pt pool, const size_t *sizes, unsigned num_blocks, alloc_pt *blocks) {
+
+	// every block up front, so a full pool fails before anything is read
+	for (unsigned i = 0; i < num_blocks; i++) {
+		blocks[i] = mem_new_alloc(pool, sizes[i]);
+
+		if (blocks[i] == NULL) {
+			_mem_io_release(pool, blocks, i);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	// one readv() per IOV_MAX blocks, stop at the first one that comes up short
+	struct iovec iov[_MEM_IO_MAX_IOV];
+	ssize_t total = 0;
+
+	for (unsigned done = 0; done < num_blocks; ) {
+
+		unsigned batch = num_blocks - done < _MEM_IO_MAX_IOV ? num_blocks - done : _MEM_IO_MAX_IOV;
+		mem_pool_gather(blocks + done, batch, iov);
+
+		size_t wanted = 0;
+		for (unsigned i = 0; i < batch; i++)
+			wanted += iov[i].iov_len;
+
+		ssize_t got;
+		do {
+			got = readv(fd, iov, (int)batch);
+		} while (got < 0 && errno == EINTR);
+
+		if (got < 0) {
+			if (total)
+				break; // what's there is the caller's, the error comes up on the next read
+
+			int saved = errno;
+			_mem_io_release(pool, blocks, num_blocks);
+			errno = saved;
+			return -1;
+		}
+
+		total += got;
+		done += batch;
+
+		if ((size_t)got < wanted)
+			break;
+
+	}
+
+	return total;
+
+}
+
+
+unsigned mem_pool_gather(const alloc_pt *allocs, unsigned num_allocs, struct iovec *iov) {
+
+	for (unsigned i = 0; i < num_allocs; i++) {
+		iov[i].iov_base = allocs[i]->mem;
+		iov[i].iov_len = allocs[i]->size;
+	}
+
+	return num_allocs;
+
+}
+
+
+#ifdef MEM_POOL_IO_URING
+
+// the pool's memory in MEM_POOL_IO_BUFFER_SIZE pieces, the most one registered buffer can be
+int mem_pool_register_buffers(int ring_fd, pool_pt pool) {
+
+	struct iovec iov[MEM_POOL_MAX_SIZE / MEM_POOL_IO_BUFFER_SIZE + 1];
+	unsigned num_buffers = 0;
+
+	for (size_t offset = 0; offset < pool->total_size; offset += MEM_IO_BUFFER_SIZE) {
+		size_t left = pool->total_size - offset;
+		iov[num_buffers].iov_base = pool->mem + offset;
+		iov[num_buffers].iov_len = left < MEM_IO_BUFFER_SIZE ? left : MEM_IO_BUFFER_SIZE;
+		num_buffers++;
+	}
+
+	return (int)syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov, num_buffers);
+
+}
+
+
+int mem_pool_unregister_buffers(int ring_fd) {
+
+	return (int)syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+}
+
+#else
+
+int mem_pool_register_buffers(int ring_fd, pool_pt pool) {
+
+	(void)ring_fd;
+	(void)pool;
+	errno = ENOSYS;
+	return -1;
+
+}
+
+
+int mem_pool_unregister_buffers(int ring_fd) {
+
+	(void)ring_fd;
+	errno = ENOSYS;
+	return -1;
+
+}
+
+#endif
+
+
+unsigned mem_pool_buffer_index(pool_pt pool, const void *ptr) {
+
+	return (unsigned)(((const char *)ptr - pool->mem) / MEM_IO_BUFFER_SIZE);
+
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+
+static void _mem_io_release(pool_pt pool, alloc_pt *blocks, unsigned num_blocks) {
+
+	for (unsigned i = 0; i < num_blocks; i++) {
+		mem_del_alloc(pool, blocks[i]);
+		blocks[i] = NULL;
+	}
+
+}
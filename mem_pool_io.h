@@ -0,0 +1,64 @@
+/*
+ * Scatter/gather I/O straight into and out of pool allocations, no
+ * intermediate buffers:
+ *
+ *     size_t sizes[] = {sizeof(header_t), body_len};
+ *     alloc_pt blocks[2];
+ *     ssize_t got = mem_pool_readv(fd, pool, sizes, 2, blocks);
+ *
+ *     struct iovec iov[2];
+ *     writev(out, iov, mem_pool_gather(blocks, 2, iov));
+ *
+ * These report failures like read(2) and writev(2) do, -1 and errno. When
+ * built with MEM_POOL_IO_URING, a pool's memory can also be registered with
+ * an io_uring as fixed buffers, see mem_pool_register_buffers().
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_IO_H
+#define DENVER_OS_PA_C_MEM_POOL_IO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "mem_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* constants */
+
+/* registered buffers are at most this big, a pool takes one per started GiB */
+#define MEM_POOL_IO_BUFFER_SIZE (1 << 30)
+
+/* function declarations */
+
+// allocates a block for each size, then fills them in order with readv(), IOV_MAX blocks per call
+// returns the bytes read; the blocks are kept even if that's short of their total, or 0 at end of file
+// note: returns -1 with nothing allocated if a block can't be allocated (ENOMEM) or nothing could be read
+ssize_t
+mem_pool_readv(int fd, pool_pt pool, const size_t *sizes, unsigned num_blocks, alloc_pt *blocks);
+
+// one iovec per allocation, pointing at its memory, for writev() or a msghdr; returns num_allocs
+unsigned
+mem_pool_gather(const alloc_pt *allocs, unsigned num_allocs, struct iovec *iov);
+
+// registers all of the pool's memory as the ring's fixed buffers, so a ring serves one pool at a time
+// note: the pages are pinned until mem_pool_unregister_buffers(); trimming the pool meanwhile
+// (mem_pool_start_maintenance()) or big mem_new_alloc_zeroed() blocks hand pages back to the kernel
+// and the ring keeps using the ones it pinned; ENOSYS if not built in
+int
+mem_pool_register_buffers(int ring_fd, pool_pt pool);
+
+int
+mem_pool_unregister_buffers(int ring_fd);
+
+// buf_index for a READ_FIXED / WRITE_FIXED at ptr; one such op can't cross a MEM_POOL_IO_BUFFER_SIZE boundary
+unsigned
+mem_pool_buffer_index(pool_pt pool, const void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DENVER_OS_PA_C_MEM_POOL_IO_H
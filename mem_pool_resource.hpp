@@ -0,0 +1,172 @@
+/*
+ * C++ adapters for mem_pool: a std::pmr::memory_resource and a standard
+ * Allocator, both wrapping a pool_pt that the caller opens and closes.
+ *
+ *     pool_pt pool = mem_pool_open(1 << 20, BEST_FIT);
+ *     mem::pool_resource res(pool);
+ *     std::pmr::vector<int> v(&res);
+ *     std::vector<int, mem::pool_allocator<int>> w(mem::pool_allocator<int>(pool));
+ *
+ * The adapters keep no state of their own, so they are exactly as thread safe
+ * as the pool: one from mem_pool_share() can be used from several threads,
+ * any other from one at a time. Deallocation finds blocks with
+ * mem_find_alloc(), so pools from mem_pool_open_compact() can't be used;
+ * over-aligned blocks have a small header in front that leads back to the
+ * start of their allocation, so that's O(1) too.
+ *
+ * Node containers (unordered_map, list) leave a gap per freed node. Use
+ * BEST_FIT pools for them: a FIRST_FIT search reads every node in front of
+ * the fit, and with ~100k gaps the unordered_map workload in
+ * bench_containers takes seconds. Under BEST_FIT the node workloads there
+ * run 6-11x slower than the default allocator, the cost of the pool's own
+ * bookkeeping per block; quick lists (mem_pool_enable_quick_lists()) don't
+ * change that much, their blocks are merged back once a few hundred pile up.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
+#define DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <memory_resource>
+
+#include "mem_pool.h"
+
+namespace mem {
+
+/* helpers shared by both adapters */
+
+namespace detail {
+
+// sizes are rounded to this, so a pool used only through the adapters hands
+// out max_align_t aligned blocks without any over-allocation
+constexpr std::size_t granularity = alignof(std::max_align_t);
+
+// sits right in front of a block that is not the start of its allocation
+struct aligned_hdr {
+    std::uint64_t magic;
+    char *base;
+};
+
+constexpr std::uint64_t aligned_magic = 0x6D656D5F72657361ULL;
+
+inline void *allocate(pool_pt pool, std::size_t bytes, std::size_t alignment) {
+    std::size_t size = bytes ? (bytes + granularity - 1) & ~(granularity - 1) : granularity;
+
+    if (alignment <= granularity) {
+        alloc_pt alloc = mem_new_alloc(pool, size);
+        if (!alloc)
+            throw std::bad_alloc();
+        if (reinterpret_cast<std::uintptr_t>(alloc->mem) % alignment == 0)
+            return alloc->mem;
+        // the pool is shared with odd-sized C allocations: go the long way
+        mem_del_alloc(pool, alloc);
+    }
+
+    // over-allocate, then step up to the boundary past room for the header
+    // that leads deallocate() back to the start
+    if (size > SIZE_MAX - sizeof(aligned_hdr) - alignment)
+        throw std::bad_alloc();
+    alloc_pt alloc = mem_new_alloc(pool, size + sizeof(aligned_hdr) + alignment - 1);
+    if (!alloc)
+        throw std::bad_alloc();
+
+    std::uintptr_t mem = reinterpret_cast<std::uintptr_t>(alloc->mem) + sizeof(aligned_hdr);
+    char *ptr = reinterpret_cast<char *>((mem + alignment - 1) & ~(std::uintptr_t)(alignment - 1));
+
+    aligned_hdr hdr = {aligned_magic, alloc->mem};
+    std::memcpy(ptr - sizeof(hdr), &hdr, sizeof(hdr));
+    return ptr;
+}
+
+inline void deallocate(pool_pt pool, void *ptr) {
+    char *mem = static_cast<char *>(ptr);
+
+    alloc_pt alloc = mem_find_alloc(mem);
+
+    // not the start of an allocation, so the header says where it starts
+    if (!alloc && mem - sizeof(aligned_hdr) >= pool->mem) {
+        aligned_hdr hdr;
+        std::memcpy(&hdr, mem - sizeof(hdr), sizeof(hdr));
+        if (hdr.magic != aligned_magic)
+            return;
+        hdr.magic = 0;
+        std::memcpy(mem - sizeof(hdr), &hdr, sizeof(hdr.magic));
+        alloc = mem_find_alloc(hdr.base);
+    }
+
+    if (alloc)
+        mem_del_alloc(pool, alloc);
+}
+
+} // namespace detail
+
+/* std::pmr::memory_resource */
+
+class pool_resource : public std::pmr::memory_resource {
+public:
+    explicit pool_resource(pool_pt pool) noexcept : pool_(pool) {}
+
+    pool_pt pool() const noexcept { return pool_; }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return detail::allocate(pool_, bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override {
+        detail::deallocate(pool_, ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        const pool_resource *res = dynamic_cast<const pool_resource *>(&other);
+        return res && res->pool_ == pool_;
+    }
+
+private:
+    pool_pt pool_;
+};
+
+/* Allocator */
+
+template <class T>
+class pool_allocator {
+public:
+    using value_type = T;
+
+    explicit pool_allocator(pool_pt pool) noexcept : pool_(pool) {}
+
+    template <class U>
+    pool_allocator(const pool_allocator<U> &other) noexcept : pool_(other.pool()) {}
+
+    T *allocate(std::size_t n) {
+        if (n > SIZE_MAX / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast<T *>(detail::allocate(pool_, n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t) noexcept {
+        detail::deallocate(pool_, ptr);
+    }
+
+    pool_pt pool() const noexcept { return pool_; }
+
+private:
+    pool_pt pool_;
+};
+
+template <class T, class U>
+bool operator==(const pool_allocator<T> &a, const pool_allocator<U> &b) noexcept {
+    return a.pool() == b.pool();
+}
+
+template <class T, class U>
+bool operator!=(const pool_allocator<T> &a, const pool_allocator<U> &b) noexcept {
+    return !(a == b);
+}
+
+} // namespace mem
+
+#endif //DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
@@ -0,0 +1,199 @@
+/*
+ * Header-only C++ size-class cache in front of a mem_pool:
+ *
+ *     mem::size_class_cache<BEST_FIT, 16, 16, 32, 64, 128> cache(1 << 20);
+ *     void *p = cache.allocate<24>();  // size class resolved at compile time
+ *     cache.deallocate<24>(p);
+ *
+ * Each size class keeps a free list of blocks carved from chunks of the
+ * underlying C pool, so the known-size path is a table lookup the compiler
+ * does plus a pop. Anything bigger than the largest class goes to
+ * mem_new_alloc() directly. mem_init() must have been called first.
+ *
+ * This is a cache, not a specialized pool: only the size classes are compile
+ * time, Policy is just passed to mem_pool_open(), and the C pool's fit search
+ * and size handling run unchanged, once per chunk. A block that
+ * is deallocated goes back on its class's free list, not to the pool; chunks
+ * are returned only by the destructor. So the pool's num_allocs, tags, marks
+ * (mem_pool_release_to()) and quick lists see whole chunks, never the blocks.
+ *
+ * The free lists are not locked, so an instance belongs to one thread at a
+ * time even if pool() was passed to mem_pool_share(). The pool comes from
+ * mem_pool_open(), large blocks are found again with mem_find_alloc().
+ */
+
+#ifndef DENVER_OS_PA_C_SIZE_CLASS_CACHE_HPP
+#define DENVER_OS_PA_C_SIZE_CLASS_CACHE_HPP
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "mem_pool.h"
+
+namespace mem {
+
+template <alloc_policy Policy, std::size_t Alignment, std::size_t... SizeClasses>
+class size_class_cache {
+
+    /* compile-time tables */
+
+    static constexpr std::size_t num_classes = sizeof...(SizeClasses);
+    static constexpr std::array<std::size_t, num_classes> class_sizes = {SizeClasses...};
+
+    static constexpr bool classes_valid() {
+        for (std::size_t i = 0; i < num_classes; i ++) {
+            if (class_sizes[i] % Alignment || class_sizes[i] < sizeof(void *))
+                return false;
+            if (i && class_sizes[i] <= class_sizes[i - 1])
+                return false;
+        }
+        return true;
+    }
+
+    static_assert(Alignment && !(Alignment & (Alignment - 1)), "alignment must be a power of 2");
+    static_assert(num_classes > 0, "at least one size class");
+    static_assert(classes_valid(), "size classes must be ascending multiples of the alignment, and hold a pointer");
+
+    static constexpr std::size_t max_class_size = class_sizes[num_classes - 1];
+
+    // index of the smallest class that fits, num_classes if none does
+    static constexpr std::size_t class_index(std::size_t size) {
+        for (std::size_t i = 0; i < num_classes; i ++)
+            if (size <= class_sizes[i])
+                return i;
+        return num_classes;
+    }
+
+    // the same for run-time sizes, one entry per Alignment step
+    static constexpr std::array<unsigned char, max_class_size / Alignment + 1> make_class_table() {
+        std::array<unsigned char, max_class_size / Alignment + 1> table{};
+        for (std::size_t step = 0; step < table.size(); step ++)
+            table[step] = (unsigned char) class_index(step * Alignment);
+        return table;
+    }
+
+    static_assert(num_classes < 256, "size class table holds indices in a byte");
+    static constexpr std::array<unsigned char, max_class_size / Alignment + 1> class_table = make_class_table();
+
+    // blocks are carved a chunk at a time, roughly a page of them
+    static constexpr std::size_t chunk_blocks(std::size_t cls) {
+        return class_sizes[cls] >= 4096 ? 1 : 4096 / class_sizes[cls];
+    }
+
+    static constexpr std::size_t round_up(std::size_t size) {
+        return size ? (size + Alignment - 1) & ~(Alignment - 1) : Alignment;
+    }
+
+public:
+    explicit size_class_cache(std::size_t size) : pool_(mem_pool_open(size, Policy)) {
+        if (!pool_)
+            throw std::bad_alloc();
+        free_.fill(nullptr);
+    }
+
+    size_class_cache(const size_class_cache &) = delete;
+    size_class_cache &operator=(const size_class_cache &) = delete;
+
+    ~size_class_cache() {
+        for (alloc_pt chunk : chunks_)
+            mem_del_alloc(pool_, chunk);
+        mem_pool_close(pool_);
+    }
+
+    /* known sizes */
+
+    template <std::size_t Size>
+    void *allocate() {
+        constexpr std::size_t cls = class_index(Size);
+        if constexpr (cls == num_classes) {
+            return allocate_large(Size);
+        } else {
+            void *block = free_[cls];
+            if (__builtin_expect(block == nullptr, 0))
+                return refill(cls);
+            free_[cls] = *static_cast<void **>(block);
+            return block;
+        }
+    }
+
+    template <std::size_t Size>
+    void deallocate(void *block) noexcept {
+        constexpr std::size_t cls = class_index(Size);
+        if constexpr (cls == num_classes) {
+            deallocate_large(block);
+        } else {
+            *static_cast<void **>(block) = free_[cls];
+            free_[cls] = block;
+        }
+    }
+
+    /* run-time sizes */
+
+    void *allocate(std::size_t size) {
+        if (size > max_class_size)
+            return allocate_large(size);
+        std::size_t cls = class_table[(size + Alignment - 1) / Alignment];
+        void *block = free_[cls];
+        if (__builtin_expect(block == nullptr, 0))
+            return refill(cls);
+        free_[cls] = *static_cast<void **>(block);
+        return block;
+    }
+
+    void deallocate(void *block, std::size_t size) noexcept {
+        if (size > max_class_size) {
+            deallocate_large(block);
+            return;
+        }
+        std::size_t cls = class_table[(size + Alignment - 1) / Alignment];
+        *static_cast<void **>(block) = free_[cls];
+        free_[cls] = block;
+    }
+
+    pool_pt pool() const noexcept { return pool_; }
+
+private:
+    // note: every size handed to the C pool is a multiple of Alignment and
+    // the pool's memory is page aligned, so every block is aligned too
+    void *refill(std::size_t cls) {
+        std::size_t size = class_sizes[cls];
+        std::size_t blocks = chunk_blocks(cls);
+
+        chunks_.reserve(chunks_.size() + 1);
+        alloc_pt chunk = mem_new_alloc(pool_, size * blocks);
+        if (!chunk)
+            throw std::bad_alloc();
+        chunks_.push_back(chunk);
+
+        // hand out the first block, the rest go on the free list in order
+        for (std::size_t i = blocks - 1; i > 0; i --) {
+            void *block = chunk->mem + i * size;
+            *static_cast<void **>(block) = free_[cls];
+            free_[cls] = block;
+        }
+        return chunk->mem;
+    }
+
+    void *allocate_large(std::size_t size) {
+        alloc_pt alloc = mem_new_alloc(pool_, round_up(size));
+        if (!alloc)
+            throw std::bad_alloc();
+        return alloc->mem;
+    }
+
+    void deallocate_large(void *block) noexcept {
+        alloc_pt alloc = mem_find_alloc(block);
+        if (alloc)
+            mem_del_alloc(pool_, alloc);
+    }
+
+    pool_pt pool_;
+    std::array<void *, num_classes> free_;
+    std::vector<alloc_pt> chunks_;
+};
+
+} // namespace mem
+
+#endif //DENVER_OS_PA_C_SIZE_CLASS_CACHE_HPP